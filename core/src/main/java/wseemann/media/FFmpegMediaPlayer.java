@@ -946,6 +946,19 @@ public class FFmpegMediaPlayer
      */
     public native void prepare() throws IOException, IllegalStateException;
 
+    /**
+     * Prepares the player for playback, synchronously, waiting at most
+     * timeoutMs for the data source to be opened and buffered. A source
+     * that does not get ready in time, such as a stalled network stream,
+     * fails instead of blocking the caller indefinitely.
+     *
+     * @param timeoutMs the longest time to wait in milliseconds, 0 to
+     * wait as long as it takes, like {@link #prepare()}
+     * @throws IOException if preparing failed or timed out
+     * @throws IllegalStateException if it is called in an invalid state
+     */
+    public native void prepare(int timeoutMs) throws IOException, IllegalStateException;
+
     /**
      * Prepares the player for playback, asynchronously.
      *
@@ -1146,10 +1159,11 @@ public class FFmpegMediaPlayer
     	boolean apply_filter = false;
     	
     	Metadata data = new Metadata();
-    	HashMap<String, String> metadata = null;
-        if ((metadata = native_getMetadata(update_only, apply_filter, metadata)) == null) {
+    	String[] keyValues;
+        if ((keyValues = native_getMetadata(update_only, apply_filter)) == null) {
             return null;
         }
+        HashMap<String, String> metadata = toHashMap(keyValues);
 
         // Metadata takes over the parcel, don't recycle it unless
         // there is an error.
@@ -1159,6 +1173,38 @@ public class FFmpegMediaPlayer
     	return data;
     }
 
+    /**
+     * Reads the metadata of a file or stream without preparing a player.
+     * Usually only the container is opened and no thread or audio and video
+     * output is set up, which makes it suited to scanning large media
+     * libraries. Sources whose container has no header or no duration,
+     * such as raw streams, are also probed briefly, which opens their
+     * decoders. The keys are the ones {@link #getMetadata()} returns
+     * after {@link #prepare()}.
+     *
+     * <p>This call blocks, for network sources run it off the main thread.
+     * It gives up after 10 seconds.</p>
+     *
+     * @param path the path of the file, or the http/rtsp URL of the stream
+     * @return The metadata, possibly empty. null if the source could not
+     * be opened.
+     * @throws IllegalArgumentException if path is null
+     */
+    public static Metadata probeMetadata(String path) {
+        String[] keyValues;
+        if ((keyValues = native_probeMetadata(path)) == null) {
+            return null;
+        }
+
+        Metadata data = new Metadata();
+        if (!data.parse(toHashMap(keyValues))) {
+            return null;
+        }
+        return data;
+    }
+
+    private static native String[] native_probeMetadata(String path);
+
     /**
      * Set a filter for the metadata update notification and update
      * retrieval. The caller provides 2 set of metadata keys, allowed
@@ -1241,6 +1287,7 @@ public class FFmpegMediaPlayer
         mOnInfoListener = null;
         mOnVideoSizeChangedListener = null;
         mOnTimedTextListener = null;
+        mOnMetadataUpdateListener = null;
         _release();
     }
 
@@ -1300,6 +1347,151 @@ public class FFmpegMediaPlayer
      */
     public native void setVolume(float leftVolume, float rightVolume);
 
+    /**
+     * Sets the playback speed of this player. The audio is time stretched
+     * so its pitch is preserved, and the video follows the audio. The speed
+     * may be changed at any time, including during playback.
+     *
+     * @param speed the playback speed, from 0.5 (half speed) to 3.0
+     * (three times normal speed). 1.0 is normal speed.
+     * @throws IllegalArgumentException if the speed is out of range
+     */
+    public native void setPlaybackSpeed(float speed);
+
+    /**
+     * Loudness normalization is disabled, the audio is played at its
+     * original level.
+     * @see #setLoudnessNormalization(int)
+     */
+    public static final int LOUDNESS_NORMALIZATION_OFF = 0;
+
+    /**
+     * Normalizes each track using its ReplayGain or R128 track gain.
+     * @see #setLoudnessNormalization(int)
+     */
+    public static final int LOUDNESS_NORMALIZATION_TRACK = 1;
+
+    /**
+     * Normalizes using the ReplayGain or R128 album gain, falling back to
+     * the track gain when the album gain is missing.
+     * @see #setLoudnessNormalization(int)
+     */
+    public static final int LOUDNESS_NORMALIZATION_ALBUM = 2;
+
+    /**
+     * Sets the loudness normalization mode. When the media has no
+     * ReplayGain or R128 gain tags, its EBU R128 integrated loudness is
+     * measured while it plays and the gain follows the measurement after
+     * the first few seconds. The gain is applied on top of the volume set
+     * with {@link #setVolume(float, float)}.
+     *
+     * @param mode one of {@link #LOUDNESS_NORMALIZATION_OFF},
+     * {@link #LOUDNESS_NORMALIZATION_TRACK} or {@link #LOUDNESS_NORMALIZATION_ALBUM}
+     * @throws IllegalArgumentException if the mode is unknown
+     */
+    public native void setLoudnessNormalization(int mode);
+
+    /**
+     * Sets the length of the crossfade into the player set with
+     * {@link #setNextMediaPlayer(FFmpegMediaPlayer)}. The tail of this
+     * player is mixed with the head of the next one in this player's
+     * audio output. Crossfades only apply to audio-only media with the
+     * same sample rate and channel count, other transitions stay
+     * gapless. A duration of 0 disables the crossfade.
+     *
+     * @param msec the crossfade duration in milliseconds, from 0 to 12000
+     * @throws IllegalArgumentException if the duration is out of range
+     */
+    public native void setCrossfadeDuration(int msec);
+
+    /**
+     * Sets how much media is buffered before the player reports itself
+     * prepared. Each audio and video stream must have this much queued,
+     * unless the whole input is shorter. A preroll of 0 selects fast
+     * start: the player is prepared as soon as the first audio packet and
+     * the first video key frame are available. Takes effect on the next
+     * call to {@link #prepare()} or {@link #prepareAsync()}; the default
+     * is 300 milliseconds.
+     *
+     * @param msec the preroll in milliseconds, from 0 to 10000
+     * @throws IllegalArgumentException if the preroll is out of range
+     */
+    public native void setPreroll(int msec);
+
+    /**
+     * Enables the low latency mode for live streams, such as live HLS and
+     * internet radio, and sets how far behind live playback should stay.
+     * While playback is further behind it plays up to 10% faster, without
+     * changing the pitch, and when it is more than five seconds behind
+     * the target the excess is dropped. The stream is also opened with less probing
+     * and buffering, for a faster start. Media with a known duration is
+     * not affected. A latency of 0 disables the mode, which is the
+     * default; the faster start takes effect on the next call to
+     * {@link #prepare()} or {@link #prepareAsync()}.
+     *
+     * @param msec the target latency in milliseconds, from 0 to 60000
+     * @throws IllegalArgumentException if the latency is out of range
+     */
+    public native void setLiveLatency(int msec);
+
+    /**
+     * Sets how many bytes of the data source a background thread reads
+     * ahead of the demuxer. The read-ahead absorbs network and storage
+     * stalls and turns many small reads into a few large ones. A size of
+     * 0 reads the data source directly. Takes effect on the next call to
+     * {@link #prepare()} or {@link #prepareAsync()}; the default is 2 MB.
+     *
+     * @param bytes the read-ahead size in bytes, from 0 to 64 MB
+     * @throws IllegalArgumentException if the size is out of range
+     */
+    public native void setReadAheadSize(int bytes);
+
+    /**
+     * Sets the directory the stream parameters of opened media are cached
+     * in. Media opened again is then matched by its location, size and
+     * first bytes, and skips most or all of the stream probing, which
+     * shortens {@link #prepare()} considerably. The setting applies to
+     * every player in the process. Pass null to disable the cache, which
+     * is the default.
+     *
+     * @param path a directory the application can write to, such as one
+     * inside {@code Context.getCacheDir()}, or null
+     * @throws IllegalArgumentException if the directory cannot be created
+     */
+    public static native void setProbeCacheDirectory(String path);
+
+    /**
+     * Enables a persistent download cache for http and https data sources
+     * of known length. Downloaded byte ranges are kept on disk, so replays
+     * and seeks back into already downloaded parts are served without the
+     * network. When the cache grows past maxBytes, the least recently
+     * played sources are evicted. Live streams are never cached. The
+     * setting applies to every player in the process; pass null to disable
+     * the cache, which is the default.
+     *
+     * @param path a directory the application can write to, such as one
+     * inside {@code Context.getCacheDir()}, or null
+     * @param maxBytes the size budget of the cache in bytes
+     * @throws IllegalArgumentException if the directory cannot be created
+     * or the budget is not positive
+     */
+    public static native void setHttpCacheDirectory(String path, long maxBytes);
+
+    /**
+     * Sets an FFmpeg option used when the data source is opened, such as
+     * {@code probesize}, {@code analyzeduration}, {@code fpsprobesize} or
+     * a protocol option. The key {@code format} names the input format,
+     * for example {@code mp3} or {@code aac}, and skips format probing
+     * entirely. Options apply from the next call to {@link #prepare()} or
+     * {@link #prepareAsync()} and are kept across data sources.
+     *
+     * @param key the option name
+     * @param value the option value, or null to remove the option
+     * @throws IllegalArgumentException if the key is empty or the format
+     * is unknown
+     */
+    public native void setOption(String key, String value);
+
     /**
      * Currently not implemented, returns null.
      * @deprecated
@@ -1494,13 +1686,23 @@ public class FFmpegMediaPlayer
      *                    time. If false, all the metadatas are considered.
      * @param apply_filter  If true, once the metadata set has been built based on
      *                     the value update_only, the current filter is applied.
-     * @param reply[out] On return contains the serialized
-     *                   metadata. Valid only if the call was successful.
-     * @return The status code.
+     * @return The metadata as alternating keys and values, null if
+     *         an error occured.
+     */
+    private native final String[] native_getMetadata(boolean update_only,
+                                                    boolean apply_filter);
+
+    /*
+     * The native side flattens its metadata into alternating keys and
+     * values so it crosses JNI in one call.
      */
-    private native final HashMap<String, String> native_getMetadata(boolean update_only,
-                                                    boolean apply_filter,
-                                                    HashMap<String, String> reply);
+    private static HashMap<String, String> toHashMap(String[] keyValues) {
+        HashMap<String, String> map = new HashMap<String, String>(keyValues.length);
+        for (int i = 0; i + 1 < keyValues.length; i += 2) {
+            map.put(keyValues[i], keyValues[i + 1]);
+        }
+        return map;
+    }
 
     /**
      * @param request Parcel with the 2 serialized lists of allowed
@@ -1626,12 +1828,19 @@ public class FFmpegMediaPlayer
                 return;
 
             case MEDIA_INFO:
-                if (msg.arg1 != MEDIA_INFO_VIDEO_TRACK_LAGGING) {
+                if (msg.arg1 != MEDIA_INFO_VIDEO_TRACK_LAGGING &&
+                        msg.arg1 != MEDIA_INFO_NETWORK_BANDWIDTH) {
                     Log.i(TAG, "Info (" + msg.arg1 + "," + msg.arg2 + ")");
                 }
                 if (mOnInfoListener != null) {
                     mOnInfoListener.onInfo(mMediaPlayer, msg.arg1, msg.arg2);
                 }
+                if (msg.arg1 == MEDIA_INFO_METADATA_UPDATE && msg.obj instanceof String[] &&
+                        mOnMetadataUpdateListener != null) {
+                    Metadata data = new Metadata();
+                    data.parse(toHashMap((String[]) msg.obj));
+                    mOnMetadataUpdateListener.onMetadataUpdate(mMediaPlayer, data);
+                }
                 // No real default action so far.
                 return;
             case MEDIA_TIMED_TEXT:
@@ -1876,6 +2085,12 @@ public class FFmpegMediaPlayer
      */
     public static final int MEDIA_ERROR_NOT_VALID_FOR_PROGRESSIVE_PLAYBACK = 200;
 
+    /** File or network related operation errors, reported as the extra code
+     * once a dropped stream could not be reconnected.
+     * @see android.media.MediaPlayer.OnErrorListener
+     */
+    public static final int MEDIA_ERROR_IO = -1004;
+
     /**
      * Interface definition of a callback to be invoked when there
      * has been an error during an asynchronous operation (other errors
@@ -1893,7 +2108,7 @@ public class FFmpegMediaPlayer
          * <li>{@link #MEDIA_ERROR_SERVER_DIED}
          * </ul>
          * @param extra an extra code, specific to the error. Typically
-         * implementation dependant.
+         * implementation dependant, {@link #MEDIA_ERROR_IO} for read errors.
          * @return True if the method handled the error, false if it didn't.
          * Returning false, or not having an OnErrorListener at all, will
          * cause the OnCompletionListener to be called.
@@ -1923,6 +2138,13 @@ public class FFmpegMediaPlayer
      */
     public static final int MEDIA_INFO_UNKNOWN = 1;
 
+    /** The player was started because it was used as the next player for another
+     * player, which just completed playback.
+     * @see android.media.MediaPlayer.OnInfoListener
+     * @see #setNextMediaPlayer(FFmpegMediaPlayer)
+     */
+    public static final int MEDIA_INFO_STARTED_AS_NEXT = 2;
+
     /** The video is too complex for the decoder: it can't decode frames fast
      *  enough. Possibly only the audio plays fine at this stage.
      * @see android.media.MediaPlayer.OnInfoListener
@@ -1940,6 +2162,12 @@ public class FFmpegMediaPlayer
      */
     public static final int MEDIA_INFO_BUFFERING_END = 702;
 
+    /** Estimated network bandwidth, reported periodically while streaming.
+     * The extra code is the smoothed download rate in kbps.
+     * @see android.media.MediaPlayer.OnInfoListener
+     */
+    public static final int MEDIA_INFO_NETWORK_BANDWIDTH = 703;
+
     /** Bad interleaving means that a media has been improperly interleaved or
      * not interleaved at all, e.g has all the video samples first then all the
      * audio ones. Video is playing but a lot of disk seeks may be happening.
@@ -1952,7 +2180,9 @@ public class FFmpegMediaPlayer
      */
     public static final int MEDIA_INFO_NOT_SEEKABLE = 801;
 
-    /** A new set of metadata is available.
+    /** A new set of metadata is available. For a shoutcast stream this
+     * is sent each time the ICY title changes, and the changed keys go to
+     * the {@link OnMetadataUpdateListener}.
      * @see android.media.MediaPlayer.OnInfoListener
      */
     public static final int MEDIA_INFO_METADATA_UPDATE = 802;
@@ -1970,9 +2200,11 @@ public class FFmpegMediaPlayer
          * @param what    the type of info or warning.
          * <ul>
          * <li>{@link #MEDIA_INFO_UNKNOWN}
+         * <li>{@link #MEDIA_INFO_STARTED_AS_NEXT}
          * <li>{@link #MEDIA_INFO_VIDEO_TRACK_LAGGING}
          * <li>{@link #MEDIA_INFO_BUFFERING_START}
          * <li>{@link #MEDIA_INFO_BUFFERING_END}
+         * <li>{@link #MEDIA_INFO_NETWORK_BANDWIDTH}
          * <li>{@link #MEDIA_INFO_BAD_INTERLEAVING}
          * <li>{@link #MEDIA_INFO_NOT_SEEKABLE}
          * <li>{@link #MEDIA_INFO_METADATA_UPDATE}
@@ -1997,6 +2229,37 @@ public class FFmpegMediaPlayer
     }
 
     private OnInfoListener mOnInfoListener;
+
+    /**
+     * Interface definition of a callback to be invoked when the metadata
+     * of a stream changes during playback, such as the title announced
+     * in the ICY metadata of a shoutcast stream.
+     */
+    public interface OnMetadataUpdateListener
+    {
+        /**
+         * Called when the stream announces new metadata.
+         *
+         * @param mp       the MediaPlayer the metadata pertains to
+         * @param metadata only the keys that changed: "icy_title",
+         *                 "icy_url" if it changed, and the raw
+         *                 "icy_metadata" packet
+         */
+        public void onMetadataUpdate(FFmpegMediaPlayer mp, Metadata metadata);
+    }
+
+    /**
+     * Register a callback to be invoked when the metadata of a stream
+     * changes, instead of polling {@link #getMetadata()}.
+     *
+     * @param listener the callback that will be run
+     */
+    public void setOnMetadataUpdateListener(OnMetadataUpdateListener listener)
+    {
+        mOnMetadataUpdateListener = listener;
+    }
+
+    private OnMetadataUpdateListener mOnMetadataUpdateListener;
     
     private int attachAuxEffectCompat(int effectId) {
     	int ret = -3;
@@ -12,7 +12,19 @@ LOCAL_SRC_FILES := $(SDL_PATH)/src/main/android/SDL_android_main.c \
 	ffmpeg_mediaplayer.c \
 	audioplayer.c \
 	videoplayer.c \
-	ffmpeg_utils.c
+	ffmpeg_utils.c \
+	timestretch.c \
+	audiogain.c \
+	loudness.c \
+	eventqueue.c \
+	probecache.c \
+	fdio.c \
+	httpcache.c \
+	readahead.c \
+	abr.c
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_ARM_NEON := true
+endif
 LOCAL_SHARED_LIBRARIES := SDL2 libswresample libswscale libavcodec libavformat libavutil
 LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/../ffmpeg/ffmpeg/$(TARGET_ARCH_ABI)/include
 # for native audio
@@ -0,0 +1,412 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <abr.h>
+
+typedef struct AbrVariant {
+	int64_t bitrate;
+	int program;            /* HLS program, -1 for a DASH representation */
+	int audio;              /* stream index, -1 if no audio is decoded */
+	int video;
+} AbrVariant;
+
+struct Abr {
+	AVFormatContext *ic;
+	int audio_index;        /* the decoded streams, packets are mapped onto them */
+	int video_index;
+
+	AbrVariant *variants;   /* by increasing bitrate */
+	int nb_variants;
+	int current;
+	int pending;            /* waiting for a keyframe, -1 if none */
+	int switched;
+	int extradata_stream[2];  /* whose extradata the audio and the video decoder have */
+
+	int (*io_open)(AVFormatContext *s, AVIOContext **pb, const char *url,
+			int flags, AVDictionary **options);
+	void (*io_close)(AVFormatContext *s, AVIOContext *pb);
+	AVIOContext *io[ABR_MAX_IO];  /* open connections of the demuxer */
+	int nb_io;
+	int64_t closed_bytes;   /* read by connections already closed */
+
+	int64_t read_time;      /* spent in av_read_frame, reads are held back while the queues are full */
+	int64_t sample_bytes;   /* totals at the last throughput sample */
+	int64_t sample_time;
+	int64_t bandwidth;
+	int64_t update_time;
+	int64_t switch_time;
+};
+
+static int abr_io_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+		int flags, AVDictionary **options) {
+	Abr *abr = s->opaque;
+	int ret;
+
+	ret = abr->io_open(s, pb, url, flags, options);
+	if (ret >= 0 && abr->nb_io < ABR_MAX_IO) {
+		abr->io[abr->nb_io++] = *pb;
+	}
+
+	return ret;
+}
+
+static void abr_io_close(AVFormatContext *s, AVIOContext *pb) {
+	Abr *abr = s->opaque;
+	int i;
+
+	for (i = 0; i < abr->nb_io; i++) {
+		if (abr->io[i] == pb) {
+			abr->closed_bytes += pb->bytes_read;
+			abr->io[i] = abr->io[--abr->nb_io];
+			break;
+		}
+	}
+
+	abr->io_close(s, pb);
+}
+
+static int64_t variant_bitrate(AVDictionary *metadata) {
+	AVDictionaryEntry *entry = av_dict_get(metadata, "variant_bitrate", NULL, 0);
+
+	return entry ? strtoll(entry->value, NULL, 10) : 0;
+}
+
+/* Whether the decoder opened for stream decoded can take the packets of stream index */
+static int compatible(AVFormatContext *ic, int index, int decoded) {
+	AVCodecParameters *par = ic->streams[index]->codecpar;
+
+	return decoded >= 0 &&
+			par->codec_type == ic->streams[decoded]->codecpar->codec_type &&
+			par->codec_id == ic->streams[decoded]->codecpar->codec_id;
+}
+
+static int uses_stream(AbrVariant *variant, int index) {
+	return variant->audio == index || variant->video == index;
+}
+
+static int is_variant_stream(Abr *abr, int index) {
+	int i;
+
+	for (i = 0; i < abr->nb_variants; i++) {
+		if (uses_stream(&abr->variants[i], index)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int add_variant(Abr *abr, int64_t bitrate, int program, int audio, int video) {
+	AbrVariant *variants;
+
+	if (bitrate <= 0 ||
+			(abr->audio_index >= 0 && audio < 0) ||
+			(abr->video_index >= 0 && video < 0)) {
+		return 0;
+	}
+
+	variants = av_realloc_array(abr->variants, abr->nb_variants + 1, sizeof(AbrVariant));
+	if (!variants) {
+		return AVERROR(ENOMEM);
+	}
+	abr->variants = variants;
+	variants[abr->nb_variants].bitrate = bitrate;
+	variants[abr->nb_variants].program = program;
+	variants[abr->nb_variants].audio = audio;
+	variants[abr->nb_variants].video = video;
+	abr->nb_variants++;
+
+	return 0;
+}
+
+static int find_variants(Abr *abr) {
+	AVFormatContext *ic = abr->ic;
+	AVProgram *program;
+	int audio, video;
+	int decoded;
+	int i, j;
+	int ret;
+
+	if (ic->nb_programs > 1) {
+		// HLS, a program per variant
+		for (i = 0; i < ic->nb_programs; i++) {
+			program = ic->programs[i];
+			audio = video = -1;
+			for (j = 0; j < program->nb_stream_indexes; j++) {
+				if (audio < 0 && compatible(ic, program->stream_index[j], abr->audio_index)) {
+					audio = program->stream_index[j];
+				}
+				if (video < 0 && compatible(ic, program->stream_index[j], abr->video_index)) {
+					video = program->stream_index[j];
+				}
+			}
+			if ((ret = add_variant(abr, variant_bitrate(program->metadata), i, audio, video)) < 0) {
+				return ret;
+			}
+		}
+		return 0;
+	}
+
+	// DASH, a stream per representation of the decoded media type
+	decoded = abr->video_index >= 0 ? abr->video_index : abr->audio_index;
+	for (i = 0; i < ic->nb_streams; i++) {
+		if (!compatible(ic, i, decoded)) {
+			continue;
+		}
+		ret = add_variant(abr, variant_bitrate(ic->streams[i]->metadata), -1,
+				decoded == abr->audio_index ? i : abr->audio_index,
+				decoded == abr->video_index ? i : abr->video_index);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int compare_variants(const void *a, const void *b) {
+	const AbrVariant *va = a;
+	const AbrVariant *vb = b;
+
+	return (va->bitrate > vb->bitrate) - (va->bitrate < vb->bitrate);
+}
+
+/* Lets the demuxer download the current and pending variant only */
+static void apply_discard(Abr *abr) {
+	AVFormatContext *ic = abr->ic;
+	AbrVariant *current = &abr->variants[abr->current];
+	AbrVariant *pending = abr->pending >= 0 ? &abr->variants[abr->pending] : NULL;
+	AbrVariant *variant;
+	int i;
+
+	for (i = 0; i < ic->nb_streams; i++) {
+		if (uses_stream(current, i) || (pending && uses_stream(pending, i))) {
+			ic->streams[i]->discard = AVDISCARD_DEFAULT;
+		} else if (is_variant_stream(abr, i)) {
+			ic->streams[i]->discard = AVDISCARD_ALL;
+		}
+	}
+
+	for (i = 0; i < abr->nb_variants; i++) {
+		variant = &abr->variants[i];
+		if (variant->program >= 0) {
+			ic->programs[variant->program]->discard =
+					variant == current || variant == pending ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+		}
+	}
+}
+
+static void select_variant(Abr *abr, int index, int64_t now) {
+	if (abr->video_index >= 0) {
+		// keep reading the current variant until the new one has a keyframe
+		abr->pending = index;
+	} else {
+		abr->current = index;
+		abr->switched = 1;
+	}
+	abr->switch_time = now;
+	apply_discard(abr);
+}
+
+/* Moves pkt onto the decoded stream of its media type */
+static void map_packet(Abr *abr, AVPacket *pkt) {
+	AVStream *from = abr->ic->streams[pkt->stream_index];
+	int video = from->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+	int index = video ? abr->video_index : abr->audio_index;
+	uint8_t *extradata;
+
+	if (abr->extradata_stream[video] != pkt->stream_index) {
+		// the decoder needs the parameter sets of the new variant
+		abr->extradata_stream[video] = pkt->stream_index;
+		if (from->codecpar->extradata_size > 0 &&
+				(extradata = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA,
+						from->codecpar->extradata_size))) {
+			memcpy(extradata, from->codecpar->extradata, from->codecpar->extradata_size);
+		}
+	}
+
+	if (pkt->stream_index != index) {
+		av_packet_rescale_ts(pkt, from->time_base, abr->ic->streams[index]->time_base);
+		pkt->stream_index = index;
+	}
+}
+
+Abr *abr_open(AVFormatContext *ic, int audio_index, int video_index) {
+	Abr *abr;
+	int i;
+
+	if (!ic || (audio_index < 0 && video_index < 0) || ic->opaque) {
+		return NULL;
+	}
+
+	abr = av_mallocz(sizeof(Abr));
+	if (!abr) {
+		return NULL;
+	}
+	abr->ic = ic;
+	abr->audio_index = audio_index;
+	abr->video_index = video_index;
+	abr->pending = -1;
+	abr->current = -1;
+	abr->extradata_stream[0] = audio_index;
+	abr->extradata_stream[1] = video_index;
+
+	if (find_variants(abr) < 0 || abr->nb_variants < 2) {
+		abr_close(&abr);
+		return NULL;
+	}
+	qsort(abr->variants, abr->nb_variants, sizeof(AbrVariant), compare_variants);
+
+	for (i = 0; i < abr->nb_variants; i++) {
+		if (abr->variants[i].audio == audio_index && abr->variants[i].video == video_index) {
+			abr->current = i;
+			break;
+		}
+	}
+	if (abr->current < 0) {
+		abr_close(&abr);
+		return NULL;
+	}
+
+	abr->io_open = ic->io_open;
+	abr->io_close = ic->io_close;
+	ic->opaque = abr;
+	ic->io_open = abr_io_open;
+	ic->io_close = abr_io_close;
+
+	abr->switch_time = av_gettime_relative();
+	apply_discard(abr);
+
+	return abr;
+}
+
+void abr_close(Abr **abr) {
+	if (!abr || !*abr) {
+		return;
+	}
+
+	av_freep(&(*abr)->variants);
+	av_freep(abr);
+}
+
+int abr_read_frame(Abr *abr, AVPacket *pkt, int *switched) {
+	AbrVariant *pending;
+	int64_t start;
+	int ret;
+
+	*switched = 0;
+
+	for (;;) {
+		start = av_gettime_relative();
+		ret = av_read_frame(abr->ic, pkt);
+		abr->read_time += av_gettime_relative() - start;
+		if (ret < 0) {
+			return ret;
+		}
+
+		if (uses_stream(&abr->variants[abr->current], pkt->stream_index)) {
+			break;
+		}
+
+		pending = abr->pending >= 0 ? &abr->variants[abr->pending] : NULL;
+		if (pending && pkt->stream_index == pending->video && (pkt->flags & AV_PKT_FLAG_KEY)) {
+			// the new variant decodes from here, stop reading the old one
+			abr->current = abr->pending;
+			abr->pending = -1;
+			abr->switched = 1;
+			apply_discard(abr);
+			break;
+		}
+
+		if (!is_variant_stream(abr, pkt->stream_index)) {
+			return ret;
+		}
+		av_packet_unref(pkt);
+	}
+
+	map_packet(abr, pkt);
+	*switched = abr->switched;
+	abr->switched = 0;
+
+	return 0;
+}
+
+void abr_update(Abr *abr, int64_t buffered, int full) {
+	AbrVariant *current = &abr->variants[abr->current];
+	int64_t now = av_gettime_relative();
+	int64_t bytes = abr->closed_bytes;
+	int64_t sample;
+	int target = 0;
+	int i;
+
+	if (now - abr->update_time < ABR_UPDATE_INTERVAL) {
+		return;
+	}
+	abr->update_time = now;
+
+	for (i = 0; i < abr->nb_io; i++) {
+		bytes += abr->io[i]->bytes_read;
+	}
+	if (abr->read_time - abr->sample_time >= ABR_MIN_SAMPLE &&
+			bytes - abr->sample_bytes >= ABR_MIN_SAMPLE_BYTES) {
+		sample = (bytes - abr->sample_bytes) * 8 * 1000000 / (abr->read_time - abr->sample_time);
+		abr->bandwidth = abr->bandwidth ?
+				abr->bandwidth + (sample - abr->bandwidth) * ABR_SMOOTHING : sample;
+		abr->sample_bytes = bytes;
+		abr->sample_time = abr->read_time;
+	}
+
+	if (!abr->bandwidth || abr->pending >= 0) {
+		return;
+	}
+
+	for (i = 1; i < abr->nb_variants; i++) {
+		if (abr->variants[i].bitrate <= abr->bandwidth * ABR_SAFETY) {
+			target = i;
+		}
+	}
+
+	if (target > abr->current) {
+		// only with a comfortable buffer, and not right after a switch
+		if ((!full && buffered < ABR_UPSWITCH_BUFFER) ||
+				now - abr->switch_time < ABR_SWITCH_INTERVAL) {
+			return;
+		}
+	} else if (target < abr->current && current->bitrate > abr->bandwidth) {
+		// the current variant cannot be sustained, unless the buffer says otherwise
+		if (full || buffered >= ABR_UPSWITCH_BUFFER ||
+				(buffered >= ABR_PANIC_BUFFER && now - abr->switch_time < ABR_SWITCH_INTERVAL)) {
+			return;
+		}
+	} else {
+		return;
+	}
+
+	select_variant(abr, target, now);
+}
+
+int64_t abr_bandwidth(Abr *abr) {
+	return abr ? abr->bandwidth : 0;
+}
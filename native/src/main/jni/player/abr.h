@@ -0,0 +1,74 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ABR_H_
+#define ABR_H_
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+#define ABR_UPDATE_INTERVAL 1000000      /* microseconds between decisions */
+#define ABR_SWITCH_INTERVAL 8000000      /* microseconds a variant is kept before switching again */
+#define ABR_UPSWITCH_BUFFER 2000000      /* microseconds queued before switching up */
+#define ABR_PANIC_BUFFER 1000000         /* below this switch down right away */
+#define ABR_MIN_SAMPLE 100000            /* microseconds of reading per throughput sample */
+#define ABR_MIN_SAMPLE_BYTES 16384
+#define ABR_SMOOTHING 0.3
+#define ABR_SAFETY 0.75                  /* of the measured bandwidth a variant may use */
+#define ABR_MAX_IO 16                    /* segment and playlist connections tracked at once */
+
+/*
+ * Adaptive variant selection for HLS and DASH. The variants of the
+ * stream are the HLS programs, or the DASH representations of the
+ * decoded media type, and all but the selected one are discarded so the
+ * demuxer stops downloading them. The bandwidth is measured from the
+ * bytes the demuxer fetches while it is being read, and a higher or
+ * lower variant is selected depending on it and on how much is queued.
+ *
+ * Packets of the selected variant are mapped onto the streams the
+ * decoders were opened for. Video switches at the first keyframe of
+ * the new variant, the old one is read until then.
+ */
+typedef struct Abr Abr;
+
+/*
+ * Returns NULL unless ic has at least two variants that carry streams
+ * compatible with the decoded audio_index and video_index, -1 for none.
+ * Hooks the io_open and io_close of ic, so it must be closed after ic.
+ */
+Abr *abr_open(AVFormatContext *ic, int audio_index, int video_index);
+void abr_close(Abr **abr);
+
+/*
+ * av_read_frame that drops the packets of the unselected variants and
+ * maps the others onto the decoded streams. switched is set once the
+ * packets come from a new variant, their timestamps may overlap those
+ * of the previous one.
+ */
+int abr_read_frame(Abr *abr, AVPacket *pkt, int *switched);
+
+/*
+ * Selects the variant, buffered is how much is queued in microseconds
+ * and full whether reading is held back because the queues are full.
+ */
+void abr_update(Abr *abr, int64_t buffered, int full);
+
+/* Smoothed bandwidth in bits per second, 0 until measured */
+int64_t abr_bandwidth(Abr *abr);
+
+#endif /*ABR_H_*/
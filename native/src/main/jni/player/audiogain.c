@@ -0,0 +1,255 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <audiogain.h>
+
+#define RAMP_MS 20
+
+static int16_t to_q14(float gain) {
+	if (!(gain > 0.0f)) {
+		return 0;
+	}
+
+	if (gain * AUDIOGAIN_UNITY >= AUDIOGAIN_MAX) {
+		return AUDIOGAIN_MAX;
+	}
+
+	return (int16_t) lrintf(gain * AUDIOGAIN_UNITY);
+}
+
+static inline int16_t scale_s16(int16_t sample, int gain) {
+	int32_t v = (sample * gain + (1 << 13)) >> 14;
+
+	if (v > INT16_MAX) {
+		return INT16_MAX;
+	} else if (v < INT16_MIN) {
+		return INT16_MIN;
+	}
+
+	return (int16_t) v;
+}
+
+/*
+ * Multiplies count samples by the left/right Q14 gains with rounding and
+ * saturation. The vector versions rely on the channels alternating
+ * left/right, which holds for mono and any even channel count.
+ */
+static void apply_gain_s16(int16_t *samples, int count, int channels, int16_t left, int16_t right) {
+	int i = 0;
+
+	if (channels == 1 || (channels & 1) == 0) {
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+		const int16_t pattern[8] = { left, right, left, right, left, right, left, right };
+		int16x8_t vg = vld1q_s16(pattern);
+
+		for (; i + 8 <= count; i += 8) {
+			int16x8_t v = vld1q_s16(samples + i);
+			int32x4_t lo = vmull_s16(vget_low_s16(v), vget_low_s16(vg));
+			int32x4_t hi = vmull_s16(vget_high_s16(v), vget_high_s16(vg));
+
+			vst1q_s16(samples + i, vcombine_s16(vqrshrn_n_s32(lo, 14), vqrshrn_n_s32(hi, 14)));
+		}
+#elif defined(__SSE2__)
+		__m128i vg = _mm_setr_epi16(left, right, left, right, left, right, left, right);
+		__m128i round = _mm_set1_epi32(1 << 13);
+
+		for (; i + 8 <= count; i += 8) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (samples + i));
+			__m128i mlo = _mm_mullo_epi16(v, vg);
+			__m128i mhi = _mm_mulhi_epi16(v, vg);
+			__m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(mlo, mhi), round), 14);
+			__m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(mlo, mhi), round), 14);
+
+			_mm_storeu_si128((__m128i *) (samples + i), _mm_packs_epi32(lo, hi));
+		}
+#endif
+		for (; i < count; i++) {
+			samples[i] = scale_s16(samples[i], (i & 1) ? right : left);
+		}
+		return;
+	}
+
+	for (; i < count; i++) {
+		samples[i] = scale_s16(samples[i], ((i % channels) & 1) ? right : left);
+	}
+}
+
+AudioGain *audiogain_create(int channels, int sample_rate) {
+	AudioGain *ag;
+
+	if (channels <= 0 || sample_rate <= 0) {
+		return NULL;
+	}
+
+	ag = calloc(1, sizeof(AudioGain));
+	if (!ag) {
+		return NULL;
+	}
+
+	ag->channels = channels;
+	ag->ramp_frames = sample_rate * RAMP_MS / 1000;
+	if (ag->ramp_frames < 1) {
+		ag->ramp_frames = 1;
+	}
+	ag->ramp_pos = ag->ramp_frames;
+	ag->gain[0] = ag->gain[1] = AUDIOGAIN_UNITY;
+	ag->start[0] = ag->start[1] = AUDIOGAIN_UNITY;
+	ag->target[0] = ag->target[1] = AUDIOGAIN_UNITY;
+	ag->pending = (AUDIOGAIN_UNITY << 16) | AUDIOGAIN_UNITY;
+
+	return ag;
+}
+
+/* May be called from any thread, the change is picked up by the next
+   audiogain_process call */
+void audiogain_set_gain(AudioGain *ag, float left, float right) {
+	int16_t l, r;
+
+	if (!ag) {
+		return;
+	}
+
+	l = to_q14(left);
+	r = to_q14(right);
+
+	if (ag->channels == 1) {
+		/* a mono output can't be panned, use the average */
+		l = r = (int16_t) ((l + r) / 2);
+	}
+
+	ag->pending = ((int32_t) r << 16) | (uint16_t) l;
+}
+
+void audiogain_process(AudioGain *ag, int16_t *samples, int frames) {
+	int32_t pending;
+	int16_t left, right;
+	int c;
+
+	if (!ag || frames <= 0) {
+		return;
+	}
+
+	pending = ag->pending;
+	left = (int16_t) (pending & 0xffff);
+	right = (int16_t) (pending >> 16);
+
+	if (left != ag->target[0] || right != ag->target[1]) {
+		/* ramp from wherever the previous ramp got to */
+		ag->start[0] = ag->gain[0];
+		ag->start[1] = ag->gain[1];
+		ag->target[0] = left;
+		ag->target[1] = right;
+		ag->ramp_pos = 0;
+	}
+
+	while (ag->ramp_pos < ag->ramp_frames && frames > 0) {
+		for (c = 0; c < 2; c++) {
+			ag->gain[c] = (int16_t) (ag->start[c] +
+					(ag->target[c] - ag->start[c]) * ag->ramp_pos / ag->ramp_frames);
+		}
+		for (c = 0; c < ag->channels; c++) {
+			samples[c] = scale_s16(samples[c], ag->gain[c & 1]);
+		}
+		samples += ag->channels;
+		frames--;
+		ag->ramp_pos++;
+	}
+
+	if (ag->ramp_pos >= ag->ramp_frames) {
+		ag->gain[0] = ag->target[0];
+		ag->gain[1] = ag->target[1];
+	}
+
+	if (frames == 0 ||
+			(ag->gain[0] == AUDIOGAIN_UNITY && ag->gain[1] == AUDIOGAIN_UNITY)) {
+		return;
+	}
+
+	apply_gain_s16(samples, frames * ag->channels, ag->channels, ag->gain[0], ag->gain[1]);
+}
+
+/*
+ * dst = dst * dst_gain + src * src_gain over count samples, with both Q14
+ * gains ramped linearly from their start to their end value. The gain is
+ * stepped every 8 samples, which is far below anything audible.
+ */
+void audiogain_mix(int16_t *dst, const int16_t *src, int count,
+		int dst_start, int dst_end, int src_start, int src_end) {
+	int i = 0, j;
+
+	if (count <= 0) {
+		return;
+	}
+
+	while (i < count) {
+		int16_t gd = (int16_t) (dst_start + (int64_t) (dst_end - dst_start) * i / count);
+		int16_t gs = (int16_t) (src_start + (int64_t) (src_end - src_start) * i / count);
+
+		if (i + 8 <= count) {
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+			int16x8_t vd = vld1q_s16(dst + i);
+			int16x8_t vs = vld1q_s16(src + i);
+			int16x4_t vgd = vdup_n_s16(gd);
+			int16x4_t vgs = vdup_n_s16(gs);
+			int32x4_t lo = vmull_s16(vget_low_s16(vd), vgd);
+			int32x4_t hi = vmull_s16(vget_high_s16(vd), vgd);
+
+			lo = vmlal_s16(lo, vget_low_s16(vs), vgs);
+			hi = vmlal_s16(hi, vget_high_s16(vs), vgs);
+			vst1q_s16(dst + i, vcombine_s16(vqrshrn_n_s32(lo, 14), vqrshrn_n_s32(hi, 14)));
+			i += 8;
+			continue;
+#elif defined(__SSE2__)
+			__m128i vd = _mm_loadu_si128((const __m128i *) (dst + i));
+			__m128i vs = _mm_loadu_si128((const __m128i *) (src + i));
+			__m128i vg = _mm_set1_epi32(((int32_t) gs << 16) | (uint16_t) gd);
+			__m128i round = _mm_set1_epi32(1 << 13);
+			__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(vd, vs), vg);
+			__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(vd, vs), vg);
+
+			lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 14);
+			hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 14);
+			_mm_storeu_si128((__m128i *) (dst + i), _mm_packs_epi32(lo, hi));
+			i += 8;
+			continue;
+#endif
+		}
+
+		for (j = 0; j < 8 && i < count; j++, i++) {
+			int32_t v = (dst[i] * gd + src[i] * gs + (1 << 13)) >> 14;
+
+			dst[i] = v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : (int16_t) v);
+		}
+	}
+}
+
+void audiogain_free(AudioGain **ag) {
+	if (ag && *ag) {
+		free(*ag);
+		*ag = NULL;
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIOGAIN_H_
+#define AUDIOGAIN_H_
+
+#include <stdint.h>
+
+#define AUDIOGAIN_UNITY 16384  /* gains are Q14, unity is 1 << 14 */
+#define AUDIOGAIN_MAX 32767    /* just under +6 dB */
+
+/*
+ * Software gain stage for interleaved S16 PCM. Even channels take the left
+ * gain, odd channels the right one. Gain changes are ramped to avoid clicks.
+ */
+typedef struct AudioGain {
+	int channels;
+	int ramp_frames;          /* length of a gain change */
+	int ramp_pos;             /* frames into the current ramp */
+	int16_t gain[2];          /* left and right gain currently applied */
+	int16_t start[2];         /* gain the current ramp started from */
+	int16_t target[2];        /* gain the current ramp ends on */
+	volatile int32_t pending; /* gain requested by audiogain_set_gain, right << 16 | left */
+} AudioGain;
+
+AudioGain *audiogain_create(int channels, int sample_rate);
+void audiogain_set_gain(AudioGain *ag, float left, float right);
+void audiogain_process(AudioGain *ag, int16_t *samples, int frames);
+void audiogain_free(AudioGain **ag);
+void audiogain_mix(int16_t *dst, const int16_t *src, int count,
+		int dst_start, int dst_end, int src_start, int src_end);
+
+#endif /*AUDIOGAIN_H_*/
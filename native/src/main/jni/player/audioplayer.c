@@ -24,13 +24,61 @@
  */
 
 #include <audioplayer.h>
+#include <pthread.h>
+
+// the engine and output mix are shared by every player in the process,
+// only the buffer queue player is created per stream
+static pthread_mutex_t engineLock = PTHREAD_MUTEX_INITIALIZER;
+static int engineRefCount = 0;
+static SLObjectItf sharedEngineObject = NULL;
+static SLEngineItf sharedEngineEngine = NULL;
+static SLObjectItf sharedOutputMixObject = NULL;
+
+// remember where the buffer about to be enqueued ends in stream time
+static void addBufferInfo(AudioPlayer *player, int len)
+{
+    VideoState *is = (VideoState *)player->state;
+    AudioBufferInfo *info;
+    int frames;
+
+    if (player->numChannels <= 0) {
+        return;
+    }
+
+    frames = len / (2 * player->numChannels);
+
+    pthread_mutex_lock(&player->clockLock);
+    if (player->bufferInfoCount == BUFFER_INFO_COUNT) {
+        player->bufferInfoStart = (player->bufferInfoStart + 1) % BUFFER_INFO_COUNT;
+        player->bufferInfoCount--;
+    }
+    info = &player->bufferInfo[(player->bufferInfoStart + player->bufferInfoCount) % BUFFER_INFO_COUNT];
+    player->bufferInfoCount++;
+
+    player->framesWritten += frames;
+    info->state = is;
+    info->endFrame = player->framesWritten;
+    info->frames = frames;
+    info->endPts = get_audio_write_clock(is);
+    info->speed = is->playback_speed;
+    pthread_mutex_unlock(&player->clockLock);
+}
+
+static void resetBufferInfo(AudioPlayer *player)
+{
+    pthread_mutex_lock(&player->clockLock);
+    player->framesWritten = 0;
+    player->bufferInfoStart = 0;
+    player->bufferInfoCount = 0;
+    pthread_mutex_unlock(&player->clockLock);
+}
 
 // this callback handler is called every time a buffer finishes playing
 void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
-    VideoState *is = (VideoState *)context;
+    AudioPlayer *player = (AudioPlayer *)context;
 
-    AudioPlayer *player = &is->audio_player;
+    VideoState *is = (VideoState *)player->state;
 
     if (player->buffer != NULL) {
         free(player->buffer);
@@ -40,45 +88,116 @@ void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
     int len = 4096;
     player->buffer = malloc(len);
     
-    is->audio_callback(context, player->buffer, len);
-    enqueue(&is->audio_player, (int16_t *) player->buffer, len);
+    // the callback may hand this player over to the next VideoState, so
+    // always enqueue on the player that fired rather than is->audio_player
+    is->audio_callback(is, player->buffer, len);
+    addBufferInfo(player, len);
+    enqueue(&player, (int16_t *) player->buffer, len);
 }
 
-// create the engine and output mix objects
-void createEngine(AudioPlayer **ps)
+// destroy the shared output mix and engine, called with engineLock held
+static void destroySharedEngine()
 {
-    AudioPlayer *player = *ps;
+    if (sharedOutputMixObject != NULL) {
+        (*sharedOutputMixObject)->Destroy(sharedOutputMixObject);
+        sharedOutputMixObject = NULL;
+    }
 
-    player->buffer = NULL;
-    
+    if (sharedEngineObject != NULL) {
+        (*sharedEngineObject)->Destroy(sharedEngineObject);
+        sharedEngineObject = NULL;
+        sharedEngineEngine = NULL;
+    }
+}
+
+// create the shared engine and output mix objects, called with engineLock held
+static SLresult createSharedEngine()
+{
     SLresult result;
 
     // create engine
-    result = slCreateEngine(&player->engineObject, 0, NULL, 0, NULL, NULL);
-    assert(SL_RESULT_SUCCESS == result);
-    (void)result;
+    result = slCreateEngine(&sharedEngineObject, 0, NULL, 0, NULL, NULL);
+    if (SL_RESULT_SUCCESS != result) {
+        sharedEngineObject = NULL;
+        return result;
+    }
 
     // realize the engine
-    result = (*player->engineObject)->Realize(player->engineObject, SL_BOOLEAN_FALSE);
-    assert(SL_RESULT_SUCCESS == result);
-    (void)result;
+    result = (*sharedEngineObject)->Realize(sharedEngineObject, SL_BOOLEAN_FALSE);
+    if (SL_RESULT_SUCCESS != result) {
+        destroySharedEngine();
+        return result;
+    }
 
     // get the engine interface, which is needed in order to create other objects
-    result = (*player->engineObject)->GetInterface(player->engineObject, SL_IID_ENGINE, &player->engineEngine);
-    assert(SL_RESULT_SUCCESS == result);
-    (void)result;
+    result = (*sharedEngineObject)->GetInterface(sharedEngineObject, SL_IID_ENGINE, &sharedEngineEngine);
+    if (SL_RESULT_SUCCESS != result) {
+        destroySharedEngine();
+        return result;
+    }
 
     // create output mix, with environmental reverb specified as a non-required interface
     const SLInterfaceID ids[1] = {SL_IID_ENVIRONMENTALREVERB};
     const SLboolean req[1] = {SL_BOOLEAN_FALSE};
-    result = (*player->engineEngine)->CreateOutputMix(player->engineEngine, &player->outputMixObject, 0, ids, req);
-    assert(SL_RESULT_SUCCESS == result);
-    (void)result;
+    result = (*sharedEngineEngine)->CreateOutputMix(sharedEngineEngine, &sharedOutputMixObject, 0, ids, req);
+    if (SL_RESULT_SUCCESS != result) {
+        sharedOutputMixObject = NULL;
+        destroySharedEngine();
+        return result;
+    }
 
     // realize the output mix
-    result = (*player->outputMixObject)->Realize(player->outputMixObject, SL_BOOLEAN_FALSE);
-    assert(SL_RESULT_SUCCESS == result);
-    (void)result;
+    result = (*sharedOutputMixObject)->Realize(sharedOutputMixObject, SL_BOOLEAN_FALSE);
+    if (SL_RESULT_SUCCESS != result) {
+        destroySharedEngine();
+        return result;
+    }
+
+    return SL_RESULT_SUCCESS;
+}
+
+// take a reference on the shared engine and output mix, creating them
+// for the first player
+SLresult createEngine(AudioPlayer **ps)
+{
+    AudioPlayer *player = *ps;
+    SLresult result;
+
+    memset(player, 0, sizeof(AudioPlayer));
+    pthread_mutex_init(&player->clockLock, NULL);
+
+    pthread_mutex_lock(&engineLock);
+    if (engineRefCount == 0 && (result = createSharedEngine()) != SL_RESULT_SUCCESS) {
+        pthread_mutex_unlock(&engineLock);
+        return result;
+    }
+    engineRefCount++;
+
+    player->engineObject = sharedEngineObject;
+    player->engineEngine = sharedEngineEngine;
+    player->outputMixObject = sharedOutputMixObject;
+    pthread_mutex_unlock(&engineLock);
+
+    return SL_RESULT_SUCCESS;
+}
+
+// drop the player's reference on the shared engine, the last player
+// destroys it
+static void releaseEngine(AudioPlayer *player)
+{
+    if (player->engineObject == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&engineLock);
+    if (--engineRefCount == 0) {
+        destroySharedEngine();
+    }
+    pthread_mutex_unlock(&engineLock);
+
+    player->engineObject = NULL;
+    player->engineEngine = NULL;
+    player->outputMixObject = NULL;
 }
 
 
@@ -87,6 +206,15 @@ void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels
 {
     AudioPlayer *player = *ps;
 
+    player->state = state;
+    player->numChannels = numChannels;
+    player->sampleRate = samplesPerSec;
+
+    // no shared engine, the player stays silent
+    if (player->engineEngine == NULL) {
+        return;
+    }
+
     SLuint32 channelMask = 0;
     
     if (numChannels == 2) {
@@ -149,7 +277,7 @@ void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels
     (void)result;
     
     // register callback on the buffer queue
-    result = (*player->bqPlayerBufferQueue)->RegisterCallback(player->bqPlayerBufferQueue, bqPlayerCallback, state);
+    result = (*player->bqPlayerBufferQueue)->RegisterCallback(player->bqPlayerBufferQueue, bqPlayerCallback, player);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
 
@@ -170,6 +298,9 @@ void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels
     result = (*player->bqPlayerObject)->GetInterface(player->bqPlayerObject, SL_IID_VOLUME, &player->bqPlayerVolume);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
+
+    // volume is applied in software, keep the player at unity
+    setVolumeUriAudioPlayer(&player, 0);
 }
 
 
@@ -189,6 +320,8 @@ void setPlayingAudioPlayer(AudioPlayer **ps, int playstate)
         state = SL_PLAYSTATE_PAUSED;
     } else {
         state = SL_PLAYSTATE_STOPPED;
+        // the playback head restarts from 0 once stopped
+        resetBufferInfo(player);
     }
     
     // make sure the URI audio player was created
@@ -201,6 +334,63 @@ void setPlayingAudioPlayer(AudioPlayer **ps, int playstate)
     }
 }
 
+// map the OpenSL playback head to the stream time of the given VideoState,
+// returns 0 on success or -1 if the position is not available
+int getAudioPlayerClock(AudioPlayer **ps, void *state, double *pts)
+{
+    AudioPlayer *player = *ps;
+    SLmillisecond position;
+    int64_t head;
+    int i, ret = -1;
+
+    if (player == NULL || player->bqPlayerPlay == NULL || player->sampleRate <= 0) {
+        return -1;
+    }
+
+    if ((*player->bqPlayerPlay)->GetPosition(player->bqPlayerPlay, &position) != SL_RESULT_SUCCESS) {
+        return -1;
+    }
+
+    head = (int64_t) position * player->sampleRate / 1000;
+
+    pthread_mutex_lock(&player->clockLock);
+    for (i = 0; i < player->bufferInfoCount; i++) {
+        AudioBufferInfo *info = &player->bufferInfo[(player->bufferInfoStart + i) % BUFFER_INFO_COUNT];
+        int64_t behind;
+
+        if (info->state != state) {
+            continue;
+        }
+
+        // the newest buffer of this state is used if the head ran past
+        // everything written, the output is starved
+        if (info->endFrame < head && i < player->bufferInfoCount - 1) {
+            continue;
+        }
+
+        behind = info->endFrame - head;
+        if (behind < 0) {
+            behind = 0;
+        } else if (behind > info->frames) {
+            // the head is still in a buffer of the previous player
+            behind = info->frames;
+        }
+
+        *pts = info->endPts - (double) behind * info->speed / player->sampleRate;
+        ret = 0;
+        break;
+    }
+
+    // buffers the head has passed are no longer needed, keep the newest
+    while (player->bufferInfoCount > 1 && player->bufferInfo[player->bufferInfoStart].endFrame < head) {
+        player->bufferInfoStart = (player->bufferInfoStart + 1) % BUFFER_INFO_COUNT;
+        player->bufferInfoCount--;
+    }
+    pthread_mutex_unlock(&player->clockLock);
+
+    return ret;
+}
+
 // expose the volume APIs
 SLVolumeItf getVolume(AudioPlayer *player)
 {
@@ -215,30 +405,40 @@ void setVolumeUriAudioPlayer(AudioPlayer **ps, int millibel)
     SLresult result;
     SLVolumeItf volumeItf = getVolume(player);
     if (NULL != volumeItf) {
-        //get min & max
-        SLmillibel MinVolume = SL_MILLIBEL_MIN;
-        SLmillibel MaxVolume = SL_MILLIBEL_MIN;
-        
+        //clamp to the supported range
+        SLmillibel MaxVolume = 0;
+        SLmillibel volume;
+
         (*volumeItf)->GetMaxVolumeLevel(volumeItf, &MaxVolume);
-        
-        SLmillibel volume = MinVolume + (SLmillibel)(((float)(MaxVolume - MinVolume)) * millibel);
-        
+
+        if (millibel > MaxVolume) {
+            volume = MaxVolume;
+        } else if (millibel < SL_MILLIBEL_MIN) {
+            volume = SL_MILLIBEL_MIN;
+        } else {
+            volume = (SLmillibel) millibel;
+        }
+
         result = (*volumeItf)->SetVolumeLevel(volumeItf, volume);
         assert(SL_RESULT_SUCCESS == result);
         (void)result;
     }
 }
 
-void queueAudioSamples(AudioPlayer **ps, void *state)
+void queueAudioSamples(AudioPlayer **ps)
 {
     AudioPlayer *player = *ps;
 
-    bqPlayerCallback(NULL, state);
+    bqPlayerCallback(NULL, player);
 }
 
 int enqueue(AudioPlayer **ps, int16_t *data, int size) {
 	AudioPlayer *player = *ps;
 
+    if (player->bqPlayerBufferQueue == NULL) {
+        return -1;
+    }
+
     SLresult result;
     result = (*player->bqPlayerBufferQueue)->Enqueue(player->bqPlayerBufferQueue, data, size);
     if (SL_RESULT_SUCCESS != result) {
@@ -264,22 +464,17 @@ void shutdown(AudioPlayer **ps)
         player->bqPlayerVolume = NULL;
     }
 
-    // destroy output mix object, and invalidate all associated interfaces
-    if (player->outputMixObject != NULL) {
-        (*player->outputMixObject)->Destroy(player->outputMixObject);
-        player->outputMixObject = NULL;
-    }
+    // the output mix and engine are shared, only drop the reference
+    releaseEngine(player);
+
+    pthread_mutex_destroy(&player->clockLock);
 
-    // destroy engine object, and invalidate all associated interfaces
-    if (player->engineObject != NULL) {
-        (*player->engineObject)->Destroy(player->engineObject);
-        player->engineObject = NULL;
-        player->engineEngine = NULL;
-    }
-    
     // delete the audio buffer
     if (player->buffer != NULL) {
         free(player->buffer);
         player->buffer = NULL;
     }
+
+    free(player);
+    *ps = NULL;
 }
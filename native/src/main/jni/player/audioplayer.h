@@ -31,12 +31,25 @@
 
 // for native asset manager
 #include <sys/types.h>
+#include <pthread.h>
 
 #include <ffmpeg_mediaplayer.h>
 #include <stdint.h>
 
 static const int BUFFER_COUNT = 2;
 
+#define BUFFER_INFO_COUNT 8
+
+// describes an enqueued buffer, used to map the playback head back to a
+// stream time
+typedef struct AudioBufferInfo {
+    void *state;          // the VideoState that filled the end of the buffer
+    int64_t endFrame;     // frames written once this buffer has played
+    int frames;
+    double endPts;        // stream time at the end of the buffer
+    float speed;          // stream seconds per output second
+} AudioBufferInfo;
+
 static const SLEnvironmentalReverbSettings reverbSettings =
     SL_I3DL2_ENVIRONMENT_PRESET_STONECORRIDOR;
 
@@ -60,14 +73,28 @@ typedef struct AudioPlayer {
     
     void (*audio_callback) (void *userdata, uint8_t *stream, int len);
     uint8_t *buffer;
+
+    // the VideoState currently feeding this player, may change on a gapless handover
+    void *state;
+
+    int numChannels;
+    int sampleRate;
+
+    // buffers enqueued but not yet known to be played, oldest first
+    pthread_mutex_t clockLock;
+    int64_t framesWritten;
+    AudioBufferInfo bufferInfo[BUFFER_INFO_COUNT];
+    int bufferInfoStart;
+    int bufferInfoCount;
 } AudioPlayer;
 
-void createEngine(AudioPlayer **ps);
+SLresult createEngine(AudioPlayer **ps);
 void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels, int samplesPerSec, int streamType);
 void setPlayingAudioPlayer(AudioPlayer **ps, int playstate);
 void setVolumeUriAudioPlayer(AudioPlayer **ps, int millibel);
-void queueAudioSamples(AudioPlayer **ps, void *state);
+void queueAudioSamples(AudioPlayer **ps);
 int enqueue(AudioPlayer **ps, int16_t *data, int size);
+int getAudioPlayerClock(AudioPlayer **ps, void *state, double *pts);
 void shutdown(AudioPlayer **ps);
 
 #endif /*AUDIOPLAYER_H_*/
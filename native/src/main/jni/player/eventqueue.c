@@ -0,0 +1,166 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <eventqueue.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <errno.h>
+
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+
+/*
+ * Bounded multi producer queue: a slot is free for position pos when its
+ * sequence equals pos and holds an event once it equals pos + 1.
+ */
+typedef struct Event {
+	uint32_t seq;
+	void *target;
+	EventHandler handler;
+	int msg;
+	int ext1;
+	int ext2;
+} Event;
+
+static Event events[EVENT_QUEUE_SIZE];
+static uint32_t enqueue_pos;
+static uint32_t dequeue_pos;         /* only touched with deliver_lock held */
+static sem_t pending;
+static pthread_mutex_t deliver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t dispatcher_once = PTHREAD_ONCE_INIT;
+static int dispatcher_started;
+
+static void *dispatch_events(void *arg) {
+	Event event;
+	Event *slot;
+
+	for (;;) {
+		while (sem_wait(&pending) != 0 && errno == EINTR) {
+		}
+
+		pthread_mutex_lock(&deliver_lock);
+
+		slot = &events[dequeue_pos & EVENT_QUEUE_MASK];
+		while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != dequeue_pos + 1) {
+			// claimed by a producer that has not finished writing it
+			sched_yield();
+		}
+
+		event = *slot;
+		__atomic_store_n(&slot->seq, dequeue_pos + EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+		dequeue_pos++;
+
+		if (event.target && event.handler) {
+			event.handler(event.target, event.msg, event.ext1, event.ext2);
+		}
+
+		pthread_mutex_unlock(&deliver_lock);
+	}
+
+	return NULL;
+}
+
+static void start_dispatcher() {
+	pthread_attr_t attr;
+	pthread_t thread;
+	uint32_t i;
+
+	for (i = 0; i < EVENT_QUEUE_SIZE; i++) {
+		events[i].seq = i;
+	}
+
+	if (sem_init(&pending, 0, 0) != 0) {
+		return;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, dispatch_events, NULL) == 0) {
+		__atomic_store_n(&dispatcher_started, 1, __ATOMIC_RELEASE);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+int eventqueue_post(void *target, EventHandler handler, int msg, int ext1, int ext2) {
+	Event *slot;
+	uint32_t pos;
+	uint32_t seq;
+
+	pthread_once(&dispatcher_once, start_dispatcher);
+
+	if (!__atomic_load_n(&dispatcher_started, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+
+	pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &events[pos & EVENT_QUEUE_MASK];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if ((int32_t) (seq - pos) < 0) {
+			// the dispatcher is a whole ring behind
+			return -1;
+		} else {
+			pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->target = target;
+	slot->handler = handler;
+	slot->msg = msg;
+	slot->ext1 = ext1;
+	slot->ext2 = ext2;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	sem_post(&pending);
+
+	return 0;
+}
+
+void eventqueue_cancel(void *target) {
+	Event *slot;
+	uint32_t pos;
+	uint32_t end;
+
+	if (!target || !__atomic_load_n(&dispatcher_started, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&deliver_lock);
+
+	end = __atomic_load_n(&enqueue_pos, __ATOMIC_ACQUIRE);
+	for (pos = dequeue_pos; pos != end; pos++) {
+		slot = &events[pos & EVENT_QUEUE_MASK];
+		while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+			// claimed but not written yet, it may be for target
+			sched_yield();
+		}
+
+		if (slot->target == target) {
+			slot->target = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&deliver_lock);
+}
@@ -0,0 +1,44 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EVENTQUEUE_H_
+#define EVENTQUEUE_H_
+
+#include <stdint.h>
+
+#define EVENT_QUEUE_SIZE 256  /* must be a power of two */
+
+typedef void (*EventHandler)(void *target, int msg, int ext1, int ext2);
+
+/*
+ * Process wide event dispatcher. Any thread may post; a single dispatcher
+ * thread, started on the first post, runs the handlers in posting order.
+ * Slots are preallocated, posting never allocates or blocks.
+ *
+ * Returns 0 on success, -1 if the queue is full or the dispatcher could
+ * not be started.
+ */
+int eventqueue_post(void *target, EventHandler handler, int msg, int ext1, int ext2);
+
+/*
+ * Drops the events still queued for target and waits for a handler that
+ * is running for it to return. Call before freeing target.
+ */
+void eventqueue_cancel(void *target);
+
+#endif /*EVENTQUEUE_H_*/
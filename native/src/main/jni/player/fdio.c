@@ -0,0 +1,197 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+
+#include <fdio.h>
+
+typedef struct FdIO {
+	int fd;
+	int64_t offset;
+	int64_t length;     /* -1 if unknown, the descriptor is not seekable */
+	int64_t pos;
+	void *map;          /* page aligned mapping covering the range */
+	size_t map_size;
+	const uint8_t *data; /* start of the range inside the mapping */
+} FdIO;
+
+static int fdio_read(void *opaque, uint8_t *buf, int buf_size) {
+	FdIO *io = opaque;
+	ssize_t n;
+
+	if (io->length >= 0) {
+		if (io->pos >= io->length) {
+			return AVERROR_EOF;
+		}
+		if (buf_size > io->length - io->pos) {
+			buf_size = io->length - io->pos;
+		}
+	}
+
+	if (io->data) {
+		memcpy(buf, io->data + io->pos, buf_size);
+		n = buf_size;
+	} else {
+		do {
+			if (io->length >= 0) {
+				n = pread(io->fd, buf, buf_size, io->offset + io->pos);
+			} else {
+				n = read(io->fd, buf, buf_size);
+			}
+		} while (n < 0 && errno == EINTR);
+
+		if (n < 0) {
+			return AVERROR(errno);
+		}
+		if (n == 0) {
+			return AVERROR_EOF;
+		}
+	}
+
+	io->pos += n;
+	return n;
+}
+
+static int64_t fdio_seek(void *opaque, int64_t offset, int whence) {
+	FdIO *io = opaque;
+	int64_t pos;
+
+	if (io->length < 0) {
+		return AVERROR(ENOSYS);
+	}
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return io->length;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = io->pos + offset;
+		break;
+	case SEEK_END:
+		pos = io->length + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (pos < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	io->pos = pos;
+	return pos;
+}
+
+static void fdio_map(FdIO *io) {
+	long page_size = sysconf(_SC_PAGESIZE);
+	int64_t map_offset;
+	void *map;
+
+	if (page_size <= 0 || io->length <= 0 || (uint64_t) io->length > SIZE_MAX / 2) {
+		return;
+	}
+
+	map_offset = io->offset - io->offset % page_size;
+	io->map_size = io->length + (io->offset - map_offset);
+
+	map = mmap(NULL, io->map_size, PROT_READ, MAP_SHARED, io->fd, map_offset);
+	if (map == MAP_FAILED) {
+		// pread works on anything mmap refuses
+		io->map_size = 0;
+		return;
+	}
+
+	io->map = map;
+	io->data = (const uint8_t *) map + (io->offset - map_offset);
+}
+
+AVIOContext *fdio_open(int fd, int64_t offset, int64_t length) {
+	AVIOContext *pb;
+	FdIO *io;
+	uint8_t *buffer;
+	struct stat st;
+
+	if (fstat(fd, &st) != 0) {
+		return NULL;
+	}
+
+	io = av_mallocz(sizeof(FdIO));
+	if (!io) {
+		return NULL;
+	}
+
+	io->fd = fd;
+	io->offset = offset > 0 ? offset : 0;
+	io->length = -1;
+
+	if (S_ISREG(st.st_mode) && io->offset <= st.st_size) {
+		io->length = st.st_size - io->offset;
+		if (length >= 0 && length < io->length) {
+			io->length = length;
+		}
+		fdio_map(io);
+	} else if (io->offset > 0 && lseek(fd, io->offset, SEEK_SET) < 0) {
+		av_free(io);
+		return NULL;
+	}
+
+	buffer = av_malloc(FDIO_BUFFER_SIZE);
+	pb = buffer ? avio_alloc_context(buffer, FDIO_BUFFER_SIZE, 0, io, fdio_read, NULL,
+			io->length >= 0 ? fdio_seek : NULL) : NULL;
+	if (!pb) {
+		av_free(buffer);
+		if (io->map) {
+			munmap(io->map, io->map_size);
+		}
+		av_free(io);
+		return NULL;
+	}
+
+	pb->seekable = io->length >= 0 ? AVIO_SEEKABLE_NORMAL : 0;
+
+	return pb;
+}
+
+void fdio_close(AVIOContext **pb) {
+	FdIO *io;
+
+	if (!pb || !*pb) {
+		return;
+	}
+
+	io = (*pb)->opaque;
+	if (io) {
+		if (io->map) {
+			munmap(io->map, io->map_size);
+		}
+		av_free(io);
+	}
+
+	av_freep(&(*pb)->buffer);
+	avio_context_free(pb);
+}
@@ -0,0 +1,37 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FDIO_H_
+#define FDIO_H_
+
+#include <stdint.h>
+#include <libavformat/avio.h>
+
+#define FDIO_BUFFER_SIZE 32768
+
+/*
+ * AVIOContext reading the range [offset, offset + length) of a file
+ * descriptor. Regular files are memory mapped, or read with pread if
+ * mapping fails, and are seekable; other descriptors are read
+ * sequentially. A negative length extends the range to the end of the
+ * file. The descriptor stays owned by the caller.
+ */
+AVIOContext *fdio_open(int fd, int64_t offset, int64_t length);
+void fdio_close(AVIOContext **pb);
+
+#endif /*FDIO_H_*/
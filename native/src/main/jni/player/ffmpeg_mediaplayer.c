@@ -18,6 +18,9 @@
 
 //#include <android/log.h>
 #include <ffmpeg_mediaplayer.h>
+#include <probecache.h>
+
+#include <sys/stat.h>
 
 static int one = 0;
 static int two = 0;
@@ -31,7 +34,8 @@ void packet_queue_init(PacketQueue *q) {
 int packet_queue_put(VideoState *is, PacketQueue *q, AVPacket *pkt) {
 
   AVPacketList *pkt1;
-  if(pkt != &is->flush_pkt && av_dup_packet(pkt) < 0) {
+  if(pkt->data != is->flush_pkt.data && pkt->data != is->loop_pkt.data &&
+     av_dup_packet(pkt) < 0) {
     return -1;
   }
   pkt1 = av_malloc(sizeof(AVPacketList));
@@ -49,6 +53,7 @@ int packet_queue_put(VideoState *is, PacketQueue *q, AVPacket *pkt) {
   q->last_pkt = pkt1;
   q->nb_packets++;
   q->size += pkt1->pkt.size;
+  q->duration += pkt1->pkt.duration;
   SDL_CondSignal(q->cond);
 
   SDL_UnlockMutex(q->mutex);
@@ -75,6 +80,7 @@ static int packet_queue_get(VideoState *is, PacketQueue *q, AVPacket *pkt, int b
 	q->last_pkt = NULL;
       q->nb_packets--;
       q->size -= pkt1->pkt.size;
+      q->duration -= pkt1->pkt.duration;
       *pkt = pkt1->pkt;
       av_free(pkt1);
       ret = 1;
@@ -82,13 +88,37 @@ static int packet_queue_get(VideoState *is, PacketQueue *q, AVPacket *pkt, int b
     } else if (!block) {
       ret = 0;
       break;
+    } else if (is->eof) {
+      /* nothing more will be queued */
+      ret = 0;
+      break;
     } else {
+      if (q == (is->audio_st ? &is->audioq : &is->videoq) &&
+          is->prepared && is->player_started && !is->paused &&
+          !__atomic_exchange_n(&is->buffering, 1, __ATOMIC_ACQ_REL)) {
+        /* playback caught up with the input */
+        notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_BUFFERING_START, 0);
+      }
       SDL_CondWait(q->cond, q->mutex);
     }
   }
   SDL_UnlockMutex(q->mutex);
   return ret;
 }
+/* Marks the end of the input and wakes up anyone waiting for packets */
+static void packet_queue_eof(VideoState *is) {
+  PacketQueue *queues[2] = { &is->audioq, &is->videoq };
+  int i;
+
+  is->eof = 1;
+  for(i = 0; i < 2; i++) {
+    if(queues[i]->initialized == 1) {
+      SDL_LockMutex(queues[i]->mutex);
+      SDL_CondSignal(queues[i]->cond);
+      SDL_UnlockMutex(queues[i]->mutex);
+    }
+  }
+}
 static void packet_queue_flush(PacketQueue *q) {
   AVPacketList *pkt, *pkt1;
 
@@ -102,29 +132,150 @@ static void packet_queue_flush(PacketQueue *q) {
   q->first_pkt = NULL;
   q->nb_packets = 0;
   q->size = 0;
+  q->duration = 0;
   SDL_UnlockMutex(q->mutex);
 }
-double get_audio_clock(VideoState *is) {
+/*
+ * Drops packets from the head of the queue until at most keep is left,
+ * in stream time base. With keyframes set the queue is only cut at a key
+ * frame. Flush and loop markers are never dropped.
+ */
+static void packet_queue_trim(VideoState *is, PacketQueue *q, int64_t keep, int keyframes) {
+  AVPacketList *pkt, *pkt1, *cut = NULL;
+  int64_t remaining;
+
+  SDL_LockMutex(q->mutex);
+  remaining = q->duration;
+  for(pkt = q->first_pkt; pkt != NULL; pkt = pkt->next) {
+    if(pkt->pkt.data == is->flush_pkt.data || pkt->pkt.data == is->loop_pkt.data) {
+      break;
+    }
+    if(remaining <= keep && (!keyframes || (pkt->pkt.flags & AV_PKT_FLAG_KEY))) {
+      cut = pkt;
+      break;
+    }
+    remaining -= pkt->pkt.duration;
+  }
+
+  if(cut) {
+    for(pkt = q->first_pkt; pkt != cut; pkt = pkt1) {
+      pkt1 = pkt->next;
+      q->nb_packets--;
+      q->size -= pkt->pkt.size;
+      q->duration -= pkt->pkt.duration;
+      av_packet_unref(&pkt->pkt);
+      av_freep(&pkt);
+    }
+    q->first_pkt = cut;
+  }
+  SDL_UnlockMutex(q->mutex);
+}
+/* Stream time of the next sample the audio callback will write */
+double get_audio_write_clock(VideoState *is) {
   double pts;
   int hw_buf_size, bytes_per_sec, n;
 
   pts = is->audio_clock; /* maintained in the audio thread */
   hw_buf_size = is->audio_buf_size - is->audio_buf_index;
   bytes_per_sec = 0;
-  n = is->audio_st->codec->channels * 2;
   if(is->audio_st) {
+    n = is->audio_st->codec->channels * 2;
     bytes_per_sec = is->audio_st->codec->sample_rate * n;
   }
   if(bytes_per_sec) {
-    pts -= (double)hw_buf_size / bytes_per_sec;
+    /* each output byte still in audio_buf covers playback_speed bytes of source */
+    pts -= (double)hw_buf_size * is->playback_speed / bytes_per_sec;
+    if(is->time_stretch) {
+      pts -= (double)timestretch_latency(is->time_stretch) / is->audio_st->codec->sample_rate;
+    }
   }
   return pts;
 }
+/* Stream time of the sample being played, taken from the output's
+   playback head when the output can report it */
+double get_audio_clock(VideoState *is) {
+  double pts;
+
+  if(is->audio_player && getAudioPlayerClock(&is->audio_player, is, &pts) == 0) {
+    return pts;
+  }
+
+  return get_audio_write_clock(is);
+}
+/* Serializes writers of clock snapshots, readers don't take it */
+static pthread_mutex_t clock_write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void clock_snapshot_write(ClockSnapshot *clock, int valid, double pts, float rate, int paused) {
+  uint32_t seq;
+
+  pthread_mutex_lock(&clock_write_lock);
+  seq = __atomic_load_n(&clock->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&clock->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  clock->valid = valid;
+  clock->paused = paused;
+  clock->rate = rate;
+  clock->pts = pts;
+  clock->time = av_gettime_relative();
+
+  __atomic_store_n(&clock->seq, seq + 2, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&clock_write_lock);
+}
+
+/* Reads a consistent snapshot and extrapolates it to now, returns -1 if
+   nothing was published yet. Safe to call from any thread without locks */
+int clock_snapshot_read(ClockSnapshot *clock, double *pts) {
+  ClockSnapshot copy;
+  uint32_t seq;
+  double elapsed;
+
+  do {
+    seq = __atomic_load_n(&clock->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1) {
+      continue;
+    }
+    copy.valid = clock->valid;
+    copy.paused = clock->paused;
+    copy.rate = clock->rate;
+    copy.pts = clock->pts;
+    copy.time = clock->time;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while((seq & 1) || __atomic_load_n(&clock->seq, __ATOMIC_RELAXED) != seq);
+
+  if(!copy.valid) {
+    return -1;
+  }
+
+  *pts = copy.pts;
+  if(!copy.paused) {
+    /* the writers publish at least once per audio buffer, don't run away
+       if they stall */
+    elapsed = (av_gettime_relative() - copy.time) / 1000000.0;
+    *pts += FFMIN(elapsed, MAX_CLOCK_EXTRAPOLATION) * copy.rate;
+  }
+
+  return 0;
+}
+
+static void publish_clock(VideoState *is, double pts) {
+  clock_snapshot_write(is->clock_out, 1, pts, is->playback_speed, is->paused || !is->player_started);
+}
+
+/* Republishes the current position, after a change of pause state or rate */
+static void republish_clock(VideoState *is) {
+  double pts;
+
+  if(clock_snapshot_read(is->clock_out, &pts) == 0) {
+    publish_clock(is, pts);
+  }
+}
+
 double get_video_clock(VideoState *is) {
   double delta;
 
   delta = (av_gettime() - is->video_current_pts_time) / 1000000.0;
-  return is->video_current_pts + delta;
+  return is->video_current_pts + delta * is->playback_speed;
 }
 double get_external_clock(VideoState *is) {
   return av_gettime() / 1000000.0;
@@ -140,21 +291,18 @@ double get_master_clock(VideoState *is) {
 }
 /* Add or subtract samples to get a better sync, return new
    audio buffer size */
-int synchronize_audio(VideoState *is, short *samples,
-		      int samples_size, double pts) {
-  int n;
-  double ref_clock;
-
-  n = 2 * is->audio_st->codec->channels;
+/* Returns the number of samples the next frame should be resampled to so
+   the audio follows the master clock, when audio isn't the master */
+int synchronize_audio(VideoState *is, int nb_samples) {
+  int wanted_nb_samples = nb_samples;
 
   if(is->av_sync_type != AV_SYNC_AUDIO_MASTER) {
     double diff, avg_diff;
-    int wanted_size, min_size, max_size /*, nb_samples */;
+    int min_nb_samples, max_nb_samples;
 
-    ref_clock = get_master_clock(is);
-    diff = get_audio_clock(is) - ref_clock;
+    diff = get_audio_clock(is) - get_master_clock(is);
 
-    if(diff < AV_NOSYNC_THRESHOLD) {
+    if(fabs(diff) < AV_NOSYNC_THRESHOLD) {
       // accumulate the diffs
       is->audio_diff_cum = diff + is->audio_diff_avg_coef
 	* is->audio_diff_cum;
@@ -163,32 +311,10 @@ int synchronize_audio(VideoState *is, short *samples,
       } else {
 	avg_diff = is->audio_diff_cum * (1.0 - is->audio_diff_avg_coef);
 	if(fabs(avg_diff) >= is->audio_diff_threshold) {
-	  wanted_size = samples_size + ((int)(diff * is->audio_st->codec->sample_rate) * n);
-	  min_size = samples_size * ((100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100);
-	  max_size = samples_size * ((100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100);
-	  if(wanted_size < min_size) {
-	    wanted_size = min_size;
-	  } else if (wanted_size > max_size) {
-	    wanted_size = max_size;
-	  }
-	  if(wanted_size < samples_size) {
-	    /* remove samples */
-	    samples_size = wanted_size;
-	  } else if(wanted_size > samples_size) {
-	    uint8_t *samples_end, *q;
-	    int nb;
-
-	    /* add samples by copying final sample*/
-	    nb = (samples_size - wanted_size);
-	    samples_end = (uint8_t *)samples + samples_size - n;
-	    q = samples_end + n;
-	    while(nb > 0) {
-	      memcpy(q, samples_end, n);
-	      q += n;
-	      nb -= n;
-	    }
-	    samples_size = wanted_size;
-	  }
+	  wanted_nb_samples = nb_samples + (int)(diff * is->audio_st->codec->sample_rate);
+	  min_nb_samples = nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+	  max_nb_samples = nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+	  wanted_nb_samples = av_clip(wanted_nb_samples, min_nb_samples, max_nb_samples);
 	}
       }
     } else {
@@ -197,10 +323,10 @@ int synchronize_audio(VideoState *is, short *samples,
       is->audio_diff_cum = 0;
     }
   }
-  return samples_size;
+  return wanted_nb_samples;
 }
 
-int decode_frame_from_packet(VideoState *is, AVFrame decoded_frame)
+int decode_frame_from_packet(VideoState *is, AVFrame decoded_frame, int wanted_nb_samples)
 {
 	int64_t src_ch_layout, dst_ch_layout;
 	int src_rate, dst_rate;
@@ -235,10 +361,19 @@ int decode_frame_from_packet(VideoState *is, AVFrame decoded_frame)
 		return -1;
 	}
 
+	/* stretch or squeeze the frame inside the resampler to follow the
+	 * master clock, rather than dropping or repeating samples */
+	if (wanted_nb_samples != src_nb_samples) {
+		if (swr_set_compensation(is->sws_ctx_audio, wanted_nb_samples - src_nb_samples, wanted_nb_samples) < 0) {
+			fprintf(stderr, "swr_set_compensation() failed\n");
+		}
+	}
+
 	/* compute the number of converted samples: buffering is avoided
 	 * ensuring that the output buffer will contain at least all the
-	 * converted input samples */
-	max_dst_nb_samples = dst_nb_samples = av_rescale_rnd(src_nb_samples, dst_rate, src_rate, AV_ROUND_UP);
+	 * converted input samples, including any delay and compensation */
+	max_dst_nb_samples = dst_nb_samples = av_rescale_rnd(swr_get_delay(is->sws_ctx_audio, src_rate) +
+			FFMAX(src_nb_samples, wanted_nb_samples), dst_rate, src_rate, AV_ROUND_UP) + 256;
 
 	/* buffer is going to be directly written to a rawaudio file, no alignment */
 	dst_nb_channels = av_get_channel_layout_nb_channels(dst_ch_layout);
@@ -248,9 +383,6 @@ int decode_frame_from_packet(VideoState *is, AVFrame decoded_frame)
 		return -1;
 	}
 
-	/* compute destination number of samples */
-	dst_nb_samples = av_rescale_rnd(swr_get_delay(is->sws_ctx_audio, src_rate) + src_nb_samples, dst_rate, src_rate, AV_ROUND_UP);
-
 	/* convert to destination format */
 	ret = swr_convert(is->sws_ctx_audio, dst_data, dst_nb_samples, (const uint8_t **)decoded_frame.data, src_nb_samples);
 	if (ret < 0) {
@@ -279,12 +411,260 @@ int decode_frame_from_packet(VideoState *is, AVFrame decoded_frame)
 	return dst_bufsize;
 }
 
-int audio_decode_frame(VideoState *is, double *pts_ptr) {
+/* Runs the converted S16 samples in audio_buf through the time stretcher,
+   return the new audio buffer size */
+static int time_stretch_audio(VideoState *is, int data_size) {
+  int n, frames;
 
-  int len1, data_size = 0, n;
-  AVPacket *pkt = &is->audio_pkt;
+  if(is->playback_speed == 1.0f && !is->time_stretch) {
+    return data_size;
+  }
+
+  n = 2 * is->audio_st->codec->channels;
+
+  if(!is->time_stretch) {
+    is->time_stretch = timestretch_create(is->audio_st->codec->channels, is->audio_st->codec->sample_rate);
+    if(!is->time_stretch) {
+      return data_size;
+    }
+  }
+
+  timestretch_set_tempo(is->time_stretch, is->playback_speed);
+  frames = timestretch_process(is->time_stretch, (int16_t *)is->audio_buf, data_size / n,
+		  (int16_t *)is->audio_buf, sizeof(is->audio_buf) / n);
+  if(frames < 0) {
+    return data_size;
+  }
+
+  return frames * n;
+}
+
+/* Pushes the volume and the loudness normalization gain to the gain stage,
+   only called by the audio thread or before it is started */
+static void apply_volume(VideoState *is) {
+  if(is->audio_gain) {
+    audiogain_set_gain(is->audio_gain, is->left_volume * is->loudness_gain,
+                       is->right_volume * is->loudness_gain);
+  }
+}
+
+/* Works out the normalization gain from the tags for the current mode,
+   or from the loudness measured so far if the audio isn't tagged. Only
+   called by the audio thread or before it is started */
+static void update_loudness_gain(VideoState *is) {
+  float gain = 0, peak = 0;
+  double lufs;
+  int found = 0;
+
+  if(is->loudness_mode == LOUDNESS_NORMALIZATION_ALBUM && is->replaygain_album) {
+    gain = is->replaygain_album_gain;
+    peak = is->replaygain_album_peak;
+    found = 1;
+  } else if(is->loudness_mode != LOUDNESS_NORMALIZATION_OFF && is->replaygain_track) {
+    gain = is->replaygain_track_gain;
+    peak = is->replaygain_track_peak;
+    found = 1;
+  } else if(is->loudness_mode != LOUDNESS_NORMALIZATION_OFF &&
+            loudness_integrated(is->loudness, LOUDNESS_MIN_BLOCKS, &lufs) == 0) {
+    gain = (float)(LOUDNESS_REFERENCE - lufs);
+    found = 1;
+  }
+
+  if(found) {
+    is->loudness_gain = powf(10.0f, gain / 20.0f);
+    /* don't let the gain push the peak into clipping */
+    if(peak > 0 && is->loudness_gain * peak > 1.0f) {
+      is->loudness_gain = 1.0f / peak;
+    }
+  } else {
+    is->loudness_gain = 1.0f;
+  }
+
+  apply_volume(is);
+}
+
+/* Feeds untagged audio to the loudness meter, no extra decoding is
+   done, the meter sees the samples as they are played */
+static void analyze_loudness(VideoState *is, int data_size) {
+  int n;
+
+  if(__atomic_exchange_n(&is->loudness_mode_changed, 0, __ATOMIC_ACQ_REL)) {
+    update_loudness_gain(is);
+  }
+
+  if(!is->loudness || is->loudness_mode == LOUDNESS_NORMALIZATION_OFF || is->replaygain_track ||
+     (is->loudness_mode == LOUDNESS_NORMALIZATION_ALBUM && is->replaygain_album)) {
+    return;
+  }
+
+  n = 2 * is->audio_st->codec->channels;
+  is->loudness_blocks += loudness_process(is->loudness, (int16_t *)is->audio_buf, data_size / n);
+
+  if(is->loudness_blocks >= LOUDNESS_UPDATE_BLOCKS) {
+    is->loudness_blocks = 0;
+    update_loudness_gain(is);
+  }
+}
+
+/* Applies the software volume to the S16 samples in audio_buf,
+   return the audio buffer size */
+static int gain_audio(VideoState *is, int data_size) {
+  int n;
+
+  if(data_size <= 0) {
+    return data_size;
+  }
+
+  if(__atomic_exchange_n(&is->volume_changed, 0, __ATOMIC_ACQ_REL)) {
+    apply_volume(is);
+  }
+
+  n = 2 * is->audio_st->codec->channels;
+  audiogain_process(is->audio_gain, (int16_t *)is->audio_buf, data_size / n);
+
+  return data_size;
+}
+
+/* Drops the encoder delay and padding described by the gapless info,
+   return the new audio buffer size */
+static int trim_audio(VideoState *is, int data_size, double *pts) {
+  int n, rate, frames;
+  double start_pts;
+
+  n = 2 * is->audio_st->codec->channels;
+  rate = is->audio_st->codec->sample_rate;
+
+  /* after a loop the start of the clip was played from the loop cache */
+  start_pts = FFMAX(is->audio_start_pts, is->loop_skip_pts);
+
+  if(start_pts > 0 && *pts < start_pts) {
+    frames = (int)lrint((start_pts - *pts) * rate);
+    if(frames * n >= data_size) {
+      return 0;
+    }
+    memmove(is->audio_buf, is->audio_buf + frames * n, data_size - frames * n);
+    data_size -= frames * n;
+    *pts = start_pts;
+  }
+
+  if(is->audio_end_pts > 0) {
+    frames = (int)lrint((is->audio_end_pts - *pts) * rate);
+    if(frames <= 0) {
+      return 0;
+    }
+    if(frames * n < data_size) {
+      data_size = frames * n;
+    }
+  }
+
+  return data_size;
+}
+
+/* Keeps the first second of a short, audio only, looping clip so the
+   loop point can be played from memory while the decoder restarts */
+static void loop_cache_audio(VideoState *is, int data_size, double pts) {
+  int n, rate, capacity, len;
+  double start_pts = 0;
+
+  if(!is->loop || is->loop_cache_ready || is->video_st ||
+     is->pFormatCtx->duration == AV_NOPTS_VALUE ||
+     is->pFormatCtx->duration > (int64_t)LOOP_CACHE_MAX_CLIP * AV_TIME_BASE) {
+    return;
+  }
+
+  n = 2 * is->audio_st->codec->channels;
+  rate = is->audio_st->codec->sample_rate;
+
+  /* leave room in audio_buf for the time stretcher output */
+  capacity = FFMIN((int)(LOOP_CACHE_DURATION * rate) * n, (int)sizeof(is->audio_buf) / 2);
+  capacity -= capacity % n;
+
+  if(is->loop_cache_size == 0) {
+    /* only cache from the beginning of the clip */
+    if(is->audio_st->start_time != AV_NOPTS_VALUE) {
+      start_pts = av_q2d(is->audio_st->time_base) * is->audio_st->start_time;
+    }
+    start_pts = FFMAX(FFMAX(start_pts, 0), is->audio_start_pts);
+    if(pts > start_pts + 0.05) {
+      return;
+    }
+    is->loop_cache_pts = pts;
+  }
+
+  if(!is->loop_cache) {
+    is->loop_cache = av_malloc(capacity);
+    if(!is->loop_cache) {
+      return;
+    }
+  }
+
+  len = FFMIN(data_size, capacity - is->loop_cache_size);
+  memcpy(is->loop_cache + is->loop_cache_size, is->audio_buf, len);
+  is->loop_cache_size += len;
+
+  if(is->loop_cache_size >= capacity) {
+    is->loop_cache_ready = 1;
+  }
+}
+
+/* Returns the pts just after the last sample in the loop cache */
+static double loop_cache_end_pts(VideoState *is) {
+  return is->loop_cache_pts + (double)is->loop_cache_size /
+    (double)(2 * is->audio_st->codec->channels * is->audio_st->codec->sample_rate);
+}
+
+/* Converts the frame in audio_frame into audio_buf and advances the
+   audio clock, return the audio buffer size */
+static int audio_process_frame(VideoState *is, double *pts_ptr) {
+  int data_size, wanted_nb_samples;
   double pts;
 
+  wanted_nb_samples = synchronize_audio(is, is->audio_frame.nb_samples);
+
+  /* samples held back by a compensating resampler must come out first */
+  if (is->audio_frame.format != AV_SAMPLE_FMT_S16 ||
+      wanted_nb_samples != is->audio_frame.nb_samples ||
+      swr_get_delay(is->sws_ctx_audio, is->audio_st->codec->sample_rate) > 0) {
+    data_size = decode_frame_from_packet(is, is->audio_frame, wanted_nb_samples);
+  } else {
+    data_size =
+      av_samples_get_buffer_size
+      (
+          NULL,
+          is->audio_st->codec->channels,
+          is->audio_frame.nb_samples,
+          is->audio_st->codec->sample_fmt,
+          1
+      );
+    memcpy(is->audio_buf, is->audio_frame.data[0], data_size);
+  }
+
+  if(data_size <= 0) {
+    return data_size;
+  }
+
+  pts = is->audio_clock;
+  *pts_ptr = pts;
+  /* the clock follows the source, sync compensation changes the output size */
+  is->audio_clock += (double)is->audio_frame.nb_samples /
+    (double)is->audio_st->codec->sample_rate;
+
+  data_size = trim_audio(is, data_size, &pts);
+  if(data_size <= 0) {
+    return 0;
+  }
+
+  analyze_loudness(is, data_size);
+  loop_cache_audio(is, data_size, pts);
+
+  return gain_audio(is, time_stretch_audio(is, data_size));
+}
+
+int audio_decode_frame(VideoState *is, double *pts_ptr, int block) {
+
+  int len1, data_size = 0, ret;
+  AVPacket *pkt = &is->audio_pkt;
+
   for(;;) {
     while(is->audio_pkt_size > 0) {
       int got_frame = 0;
@@ -294,22 +674,9 @@ int audio_decode_frame(VideoState *is, double *pts_ptr) {
 	is->audio_pkt_size = 0;
 	break;
       }
-      if (got_frame)
-      {
-    	  if (is->audio_frame.format != AV_SAMPLE_FMT_S16) {
-    		  data_size = decode_frame_from_packet(is, is->audio_frame);
-    	  } else {
-            data_size =
-              av_samples_get_buffer_size
-              (
-                  NULL,
-                  is->audio_st->codec->channels,
-                  is->audio_frame.nb_samples,
-                  is->audio_st->codec->sample_fmt,
-                  1
-              );
-            memcpy(is->audio_buf, is->audio_frame.data[0], data_size);
-    	  }
+      data_size = 0;
+      if (got_frame) {
+        data_size = audio_process_frame(is, pts_ptr);
       }
       is->audio_pkt_data += len1;
       is->audio_pkt_size -= len1;
@@ -317,11 +684,6 @@ int audio_decode_frame(VideoState *is, double *pts_ptr) {
 	/* No data yet, get more frames */
 	continue;
       }
-      pts = is->audio_clock;
-      *pts_ptr = pts;
-      n = 2 * is->audio_st->codec->channels;
-      is->audio_clock += (double)data_size /
-	(double)(n * is->audio_st->codec->sample_rate);
 
       /* We have data, return it and come back for more later */
       return data_size;
@@ -333,11 +695,70 @@ int audio_decode_frame(VideoState *is, double *pts_ptr) {
       return -1;
     }
     /* next packet */
-    if(packet_queue_get(is, &is->audioq, pkt, 1) < 0) {
+    ret = packet_queue_get(is, &is->audioq, pkt, block);
+    if(ret < 0) {
       return -1;
     }
+    if(ret == 0 && !block && !is->eof) {
+      return AUDIO_EMPTY;
+    }
+    if(ret == 0) {
+      /* end of stream, drain the frames still buffered in the decoder */
+      while(!is->audio_drained) {
+        AVPacket empty;
+        int got_frame = 0;
+
+        av_init_packet(&empty);
+        empty.data = NULL;
+        empty.size = 0;
+
+        if(!(is->audio_st->codec->codec->capabilities & AV_CODEC_CAP_DELAY) ||
+           avcodec_decode_audio4(is->audio_st->codec, &is->audio_frame, &got_frame, &empty) < 0 ||
+           !got_frame) {
+          is->audio_drained = 1;
+          break;
+        }
+
+        data_size = audio_process_frame(is, pts_ptr);
+        if(data_size > 0) {
+          return data_size;
+        }
+      }
+      return AUDIO_EOF;
+    }
     if(pkt->data == is->flush_pkt.data) {
       avcodec_flush_buffers(is->audio_st->codec);
+      if(is->time_stretch) {
+        timestretch_reset(is->time_stretch);
+      }
+      is->audio_drained = 0;
+      is->audio_complete = 0;
+      is->loop_skip_pts = 0;
+      if(!is->loop_cache_ready) {
+        is->loop_cache_size = 0;
+      }
+      continue;
+    }
+    if(pkt->data == is->loop_pkt.data) {
+      /* the demuxer looped back to the start, pts is set when it
+         resumed after the cached audio */
+      avcodec_flush_buffers(is->audio_st->codec);
+      is->audio_drained = 0;
+      is->loop_skip_pts = 0;
+      if(!is->loop_cache_ready) {
+        is->loop_cache_size = 0;
+      }
+      if(pkt->pts != AV_NOPTS_VALUE && is->loop_cache_ready) {
+        data_size = is->loop_cache_size;
+        memcpy(is->audio_buf, is->loop_cache, data_size);
+        *pts_ptr = is->loop_cache_pts;
+        is->loop_skip_pts = loop_cache_end_pts(is);
+        is->audio_clock = is->loop_skip_pts;
+        data_size = gain_audio(is, time_stretch_audio(is, data_size));
+        if(data_size > 0) {
+          return data_size;
+        }
+      }
       continue;
     }
     is->audio_pkt_data = pkt->data;
@@ -349,23 +770,120 @@ int audio_decode_frame(VideoState *is, double *pts_ptr) {
   }
 }
 
-void audio_callback(void *userdata, Uint8 *stream, int len) {
+/* Protects the next/prev links between players */
+static pthread_mutex_t next_player_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when a player mixed into a crossfade is released */
+static pthread_cond_t next_player_cond = PTHREAD_COND_INITIALIZER;
+
+/* Called from the audio callback once the last sample of this player has
+   been played. Hands the running OpenSL player over to the next player so
+   it continues without a gap, return the next player if it was handed over */
+static VideoState *start_next_player(VideoState *is) {
+  VideoState *next;
+  AudioPlayer *player;
+
+  pthread_mutex_lock(&next_player_lock);
+  next = is->next;
+  if(!next || next->quit || !next->prepared ||
+     (next->player_started && next != is->crossfade_next)) {
+    pthread_mutex_unlock(&next_player_lock);
+    return NULL;
+  }
 
-  VideoState *is = (VideoState *)userdata;
-  int len1, audio_size;
+  is->next = NULL;
+  next->prev = NULL;
+
+  if(next == is->crossfade_next) {
+    /* already audible, just take over the output */
+    is->crossfade_next = NULL;
+    player = is->audio_player;
+    is->audio_player = next->audio_player;
+    is->audio_player->state = is;
+    next->audio_player = player;
+    player->state = next;
+    pthread_mutex_unlock(&next_player_lock);
+    return next;
+  }
+
+  if(!next->audio_st || !next->audio_player ||
+     next->audio_st->codec->sample_rate != is->audio_st->codec->sample_rate ||
+     next->audio_st->codec->channels != is->audio_st->codec->channels) {
+    /* the buffer queue format can't change, fall back to the next
+       player's own OpenSL player. Its MediaPlayer starts it through
+       startAsNext when the event is delivered */
+    notify_from_thread(next, MEDIA_INFO, MEDIA_INFO_STARTED_AS_NEXT, 0);
+    pthread_mutex_unlock(&next_player_lock);
+    return NULL;
+  }
+
+  /* swap players, the idle one is released along with this player */
+  player = is->audio_player;
+  is->audio_player = next->audio_player;
+  is->audio_player->state = is;
+  next->audio_player = player;
+  player->state = next;
+
+  next->paused = 0;
+  next->player_started = 1;
+  /* posted under the lock, like the crossfade start */
+  notify_from_thread(next, MEDIA_INFO, MEDIA_INFO_STARTED_AS_NEXT, 0);
+  pthread_mutex_unlock(&next_player_lock);
+
+  return next;
+}
+
+/* Removes this player from the next/prev chain */
+static void unlink_next_player(VideoState *is) {
+  VideoState *fading;
+
+  pthread_mutex_lock(&next_player_lock);
+  if(is->next) {
+    is->next->prev = NULL;
+    is->next = NULL;
+  }
+  if(is->prev) {
+    if(is->prev->crossfade_next == is) {
+      is->prev->crossfade_next = NULL;
+    }
+    is->prev->next = NULL;
+    is->prev = NULL;
+  }
+  fading = is->crossfade_next;
+  is->crossfade_next = NULL;
+  /* unlinked, wait for a crossfade still decoding from this player, or
+     from the one it was fading into before that one plays on its own */
+  while(is->crossfade_refs > 0 || (fading && fading->crossfade_refs > 0)) {
+    pthread_cond_wait(&next_player_cond, &next_player_lock);
+  }
+  if(fading) {
+    /* stopped in the middle of a crossfade, the next player carries on
+       with its own output once its MediaPlayer gets the event. This may
+       run under our MediaPlayer's lock, so it can't start it here */
+    fading->player_started = 0;
+    notify_from_thread(fading, MEDIA_INFO, MEDIA_INFO_STARTED_AS_NEXT, 0);
+  }
+  pthread_mutex_unlock(&next_player_lock);
+}
+
+/* Fills stream with decoded audio, return the number of bytes written
+   before the end of the audio was reached, or before the queue ran dry
+   when not blocking */
+static int fill_audio(VideoState *is, Uint8 *stream, int len, int block) {
+  int len1, audio_size, filled = 0;
   double pts;
 
   while(len > 0) {
     if(is->audio_buf_index >= is->audio_buf_size) {
       /* We have already sent all our data; get more */
-      audio_size = audio_decode_frame(is, &pts);
+      audio_size = audio_decode_frame(is, &pts, block);
+      if(audio_size == AUDIO_EOF || audio_size == AUDIO_EMPTY) {
+        return filled;
+      }
       if(audio_size < 0) {
 	/* If error, output silence */
 	is->audio_buf_size = 1024;
 	memset(is->audio_buf, 0, is->audio_buf_size);
       } else {
-	audio_size = synchronize_audio(is, (int16_t *)is->audio_buf,
-				       audio_size, pts);
 	is->audio_buf_size = audio_size;
       }
       is->audio_buf_index = 0;
@@ -376,10 +894,158 @@ void audio_callback(void *userdata, Uint8 *stream, int len) {
     memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
     len -= len1;
     stream += len1;
+    filled += len1;
     is->audio_buf_index += len1;
   }
 
-  //notify_from_thread(is, MEDIA_BUFFERING_UPDATE, 0, 0);
+  return filled;
+}
+
+/* Returns the time the audio of this player ends at, 0 if unknown */
+static double audio_end_time(VideoState *is) {
+  if(is->audio_end_pts > 0) {
+    return is->audio_end_pts;
+  }
+
+  if(is->pFormatCtx->duration == AV_NOPTS_VALUE || is->pFormatCtx->duration <= 0) {
+    return 0;
+  }
+
+  return (double)(is->pFormatCtx->duration +
+      (is->pFormatCtx->start_time != AV_NOPTS_VALUE ? is->pFormatCtx->start_time : 0)) / AV_TIME_BASE;
+}
+
+/* Starts mixing the next player into the output once the remaining audio
+   of this one is no longer than the crossfade */
+static void start_crossfade(VideoState *is) {
+  VideoState *next;
+  double end, remaining;
+
+  if(is->crossfade_ms <= 0 || is->crossfade_next || is->loop || is->audio_complete ||
+     is->video_st || !is->next) {
+    return;
+  }
+
+  end = audio_end_time(is);
+  remaining = end - is->audio_clock;
+  if(end <= 0 || remaining > is->crossfade_ms / 1000.0) {
+    return;
+  }
+
+  pthread_mutex_lock(&next_player_lock);
+  next = is->next;
+  if(!next || next->quit || !next->prepared || next->player_started ||
+     !next->audio_st || next->video_st || next->loop ||
+     next->audio_st->codec->sample_rate != is->audio_st->codec->sample_rate ||
+     next->audio_st->codec->channels != is->audio_st->codec->channels) {
+    /* the gapless handover takes care of it at the end */
+    pthread_mutex_unlock(&next_player_lock);
+    return;
+  }
+
+  next->paused = 0;
+  next->player_started = 1;
+  is->crossfade_next = next;
+  is->crossfade_pos = 0;
+  is->crossfade_frames = (int)(FFMAX(remaining, 0) / is->playback_speed *
+      is->audio_st->codec->sample_rate);
+  /* posted under the lock, so unlinking next waits for it to be queued and
+     its eventqueue_cancel drops it */
+  notify_from_thread(next, MEDIA_INFO, MEDIA_INFO_STARTED_AS_NEXT, 0);
+  pthread_mutex_unlock(&next_player_lock);
+}
+
+/* Mixes the head of the next player into the len bytes of this player's
+   tail in stream, with equal power fade curves */
+static void mix_crossfade(VideoState *is, Uint8 *stream, int len) {
+  VideoState *next;
+  int n, frames, filled;
+  double t0, t1;
+
+  if(len <= 0) {
+    return;
+  }
+
+  if(is->crossfade_buf_size < len) {
+    uint8_t *buf = av_realloc(is->crossfade_buf, len);
+    if(!buf) {
+      return;
+    }
+    is->crossfade_buf = buf;
+    is->crossfade_buf_size = len;
+  }
+
+  pthread_mutex_lock(&next_player_lock);
+  next = is->crossfade_next;
+  if(!next) {
+    pthread_mutex_unlock(&next_player_lock);
+    return;
+  }
+  /* pinned, so the lock need not be held while it decodes */
+  next->crossfade_refs++;
+  pthread_mutex_unlock(&next_player_lock);
+
+  /* never wait in the audio callback, the next player's share stays
+     silent until it has packets */
+  filled = fill_audio(next, is->crossfade_buf, len, 0);
+  memset(is->crossfade_buf + filled, 0, len - filled);
+
+  pthread_mutex_lock(&next_player_lock);
+  if(--next->crossfade_refs == 0) {
+    pthread_cond_broadcast(&next_player_cond);
+  }
+  pthread_mutex_unlock(&next_player_lock);
+
+  n = 2 * is->audio_st->codec->channels;
+  frames = len / n;
+
+  t0 = is->crossfade_frames > 0 ? FFMIN((double)is->crossfade_pos / is->crossfade_frames, 1.0) : 1.0;
+  is->crossfade_pos += frames;
+  t1 = is->crossfade_frames > 0 ? FFMIN((double)is->crossfade_pos / is->crossfade_frames, 1.0) : 1.0;
+
+  audiogain_mix((int16_t *)stream, (const int16_t *)is->crossfade_buf, len / 2,
+      (int)lrint(cos(t0 * M_PI / 2) * AUDIOGAIN_UNITY),
+      (int)lrint(cos(t1 * M_PI / 2) * AUDIOGAIN_UNITY),
+      (int)lrint(sin(t0 * M_PI / 2) * AUDIOGAIN_UNITY),
+      (int)lrint(sin(t1 * M_PI / 2) * AUDIOGAIN_UNITY));
+}
+
+void audio_callback(void *userdata, Uint8 *stream, int len) {
+
+  VideoState *is = (VideoState *)userdata;
+  VideoState *next;
+  int filled;
+
+  start_crossfade(is);
+
+  filled = fill_audio(is, stream, len, 1);
+
+  if(is->crossfade_next) {
+    mix_crossfade(is, stream, filled);
+  }
+
+  if(filled < len) {
+    if(!is->audio_complete) {
+      /* everything has been played, continue with the next player */
+      is->audio_complete = 1;
+      next = start_next_player(is);
+      notify_from_thread(is, MEDIA_PLAYBACK_COMPLETE, 0, 0);
+      if(next) {
+        clock_snapshot_write(is->clock_out, 1, get_audio_write_clock(is), is->playback_speed, 1);
+        next->audio_callback(next, stream + filled, len - filled);
+        return;
+      }
+    }
+    memset(stream + filled, 0, len - filled);
+  }
+
+  if(is->audio_complete) {
+    /* nothing more to play, hold the position at the end */
+    clock_snapshot_write(is->clock_out, 1, get_audio_clock(is), is->playback_speed, 1);
+  } else {
+    publish_clock(is, get_audio_clock(is));
+  }
+
 }
 
 void video_refresh_timer(void *userdata);
@@ -430,7 +1096,7 @@ void video_display(VideoState *is) {
     rect.h = h;
     SDL_DisplayYUVOverlay(vp->bmp, &rect);*/
 
-    displayBmp(&is->video_player, vp->bmp, is->video_st->codec, is->video_st->codec->width, is->video_st->codec->height);
+    displayBmp(&is->video_player, vp->bmp, is->video_st->codec, vp->width, vp->height);
     free(vp->bmp->buffer);
   }
 }
@@ -523,6 +1189,9 @@ void video_refresh_timer(void *opaque) {
 
 	          is->video_current_pts = vp->pts;
 	          is->video_current_pts_time = av_gettime();
+	          if(is->audioStream < 0) {
+	            publish_clock(is, vp->pts);
+	          }
 
 	          delay = vp->pts - is->frame_last_pts; /* the pts from last time */
 	          if(delay <= 0 || delay >= 1.0) {
@@ -550,7 +1219,8 @@ void video_refresh_timer(void *opaque) {
 	    	}
 	          }
 
-	          is->frame_timer += delay;
+	          /* frame delays are in stream time, scale them to wall time */
+	          is->frame_timer += delay / is->playback_speed;
 	          /* computer the REAL delay */
 	          actual_delay = is->frame_timer - (av_gettime() / 1000000.0);
 	          if(actual_delay < 0.010) {
@@ -658,7 +1328,9 @@ int queue_picture(VideoState *is, AVFrame *pFrame, double pts) {
     //dst_pix_fmt = PIX_FMT_YUV420P;
     /* point pict at the queue */
 
-    updateBmp(&is->video_player, is->sws_ctx, is->video_st->codec, vp->bmp, pFrame, is->video_st->codec->width, is->video_st->codec->height);
+    /* the size changes when an adaptive stream switches variants */
+    is->sws_ctx = updateScaler(&is->video_player, is->sws_ctx, is->video_st->codec);
+    updateBmp(&is->video_player, is->sws_ctx, is->video_st->codec, vp->bmp, pFrame, vp->width, vp->height);
 
     vp->pts = pts;
 
@@ -712,14 +1384,21 @@ int video_thread(void *arg) {
   int frameFinished;
   AVFrame *pFrame;
   double pts;
+  int ret;
 
   pFrame = av_frame_alloc();
 
   for(;;) {
-    if(packet_queue_get(is, &is->videoq, packet, 1) < 0) {
+    ret = packet_queue_get(is, &is->videoq, packet, 1);
+    if(ret < 0) {
       // means we quit getting packets
       break;
     }
+    if(ret == 0) {
+      // end of stream, wait for a seek or quit
+      SDL_Delay(10);
+      continue;
+    }
     if(packet->data == is->flush_pkt.data) {
       avcodec_flush_buffers(is->video_st->codec);
       continue;
@@ -774,13 +1453,25 @@ int stream_component_open(VideoState *is, int stream_index) {
 
     // Set audio settings from codec info
 	AudioPlayer *player = malloc(sizeof(AudioPlayer));
+	if (!player) {
+		return -1;
+	}
     is->audio_player = player;
-    createEngine(&is->audio_player);
+    if (createEngine(&is->audio_player) != SL_RESULT_SUCCESS) {
+      /* nothing would pull the audio or drive its clock, play the video alone */
+      fprintf(stderr, "Unable to create the audio engine, skipping the audio stream\n");
+      shutdown(&is->audio_player);
+      is->audio_callback = NULL;
+      return -1;
+    }
     createBufferQueueAudioPlayer(&is->audio_player, is, codecCtx->channels, codecCtx->sample_rate, is->stream_type);
     //is->audio_hw_buf_size = 4096;
   } else if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO) {
 	// Set video settings from codec info
 	VideoPlayer *player = malloc(sizeof(VideoPlayer));
+	if (!player) {
+		return -1;
+	}
 	is->video_player = player;
 	createVideoEngine(&is->video_player);
 	createScreen(&is->video_player, is->native_window, 0, 0);
@@ -829,6 +1520,17 @@ int stream_component_open(VideoState *is, int stream_index) {
 		return -1;
 	}
 
+	/* created before the audio thread runs, setVolume only flags a change */
+	is->audio_gain = audiogain_create(is->audio_st->codec->channels, is->audio_st->codec->sample_rate);
+	if (!is->audio_gain) {
+		fprintf(stderr, "Could not allocate the gain stage\n");
+		return -1;
+	}
+	apply_volume(is);
+
+	/* NULL for layouts the meter doesn't weight, the audio then isn't measured */
+	is->loudness = loudness_create(is->audio_st->codec->channels, is->audio_st->codec->sample_rate);
+
     memset(&is->audio_pkt, 0, sizeof(is->audio_pkt));
     packet_queue_init(&is->audioq);
     break;
@@ -859,29 +1561,570 @@ int stream_component_open(VideoState *is, int stream_index) {
   return 0;
 }
 
+/* Sets up the encoder delay and padding trimming from the iTunSMPB tag */
+static void init_gapless_trim(VideoState *is) {
+  int64_t priming = 0, valid_samples = 0;
+  double start = 0;
+  int sample_rate;
+
+  is->audio_start_pts = 0;
+  is->audio_end_pts = 0;
+
+  if(!is->audio_st || get_gapless_info(is->pFormatCtx, is->audio_st, &priming, &valid_samples) != SUCCESS) {
+    return;
+  }
+
+  sample_rate = is->audio_st->codec->sample_rate;
+  if(is->audio_st->start_time != AV_NOPTS_VALUE && is->audio_st->start_time > 0) {
+    start = is->audio_st->start_time * av_q2d(is->audio_st->time_base);
+  }
+
+  /* libavformat already skips the encoder delay for LAME/Xing headers
+     and mp4 edit lists, and trims the padding when it knows the last
+     sample */
+  if(is->audio_st->start_skip_samples > 0 || is->audio_st->skip_samples > 0 ||
+     strstr(is->pFormatCtx->iformat->name, "mp4")) {
+    priming = 0;
+  }
+
+  is->audio_start_pts = start + (double)priming / sample_rate;
+  if(is->audio_st->last_discard_sample <= 0) {
+    is->audio_end_pts = is->audio_start_pts + (double)valid_samples / sample_rate;
+  }
+}
+
 int decode_interrupt_cb(void *opaque) {
   VideoState *is = (VideoState *)opaque;
 
   return (is && is->quit);
 }
+/* Reads the ReplayGain or R128 gain tags of the audio stream */
+static void init_loudness(VideoState *is) {
+  if(!is->audio_st) {
+    return;
+  }
+
+  is->replaygain_track = get_replaygain_info(is->pFormatCtx, is->audio_st, 0,
+      &is->replaygain_track_gain, &is->replaygain_track_peak) == SUCCESS;
+  is->replaygain_album = get_replaygain_info(is->pFormatCtx, is->audio_st, 1,
+      &is->replaygain_album_gain, &is->replaygain_album_peak) == SUCCESS;
+
+  update_loudness_gain(is);
+}
+
+/* Seeks the demuxer back to the start of the input without closing the
+   decoders, the queued packets keep playing up to the loop marker */
+static int loop_stream(VideoState *is) {
+  AVPacket pkt;
+  int64_t target = 0;
+  int cached = 0;
+
+  if(is->pFormatCtx->start_time != AV_NOPTS_VALUE) {
+    target = is->pFormatCtx->start_time;
+  }
+
+  /* resume just before the end of the cached audio, the audio path
+     plays the cache while the decoder catches up */
+  if(is->audioStream >= 0 && is->loop_cache_ready) {
+    int64_t resume = (int64_t)((loop_cache_end_pts(is) - LOOP_PREROLL) * AV_TIME_BASE);
+    if(resume > target) {
+      target = resume;
+      cached = 1;
+    }
+  }
+
+  if(avformat_seek_file(is->pFormatCtx, -1, INT64_MIN, target, target, 0) < 0) {
+    fprintf(stderr, "%s: error while looping\n", is->pFormatCtx->filename);
+    return -1;
+  }
+
+  is->audio_next_dts = AV_NOPTS_VALUE;
+  is->video_next_dts = AV_NOPTS_VALUE;
+
+  if(is->audioStream >= 0) {
+    pkt = is->loop_pkt;
+    pkt.pts = cached ? target : AV_NOPTS_VALUE;
+    packet_queue_put(is, &is->audioq, &pkt);
+  }
+  if(is->videoStream >= 0) {
+    packet_queue_put(is, &is->videoq, &is->flush_pkt);
+  }
+
+  return 0;
+}
+
+/* Wakes a synchronous prepare, error is 0 once the player is prepared.
+   Returns 0 if the prepare timed out and its outcome must not be reported */
+static int prepare_done(VideoState *is, int error) {
+  int report;
+
+  pthread_mutex_lock(&is->prepare_lock);
+  /* after a timeout the caller was already told the prepare failed */
+  report = !is->prepare_abandoned;
+  if (report) {
+    if (error) {
+      is->prepare_error = error;
+    } else {
+      is->prepared = 1;
+    }
+  }
+  pthread_cond_broadcast(&is->prepare_cond);
+  pthread_mutex_unlock(&is->prepare_lock);
+
+  return report;
+}
+
+/* A synchronous prepare returns the error, only report it to listeners otherwise */
+static void prepare_failed(VideoState *is) {
+  int prepare_sync = is->prepare_sync;
+
+  if (prepare_done(is, UNKNOWN_ERROR) && !prepare_sync) {
+    notify_from_thread(is, MEDIA_ERROR, 0, 0);
+  }
+}
+
+/* Whether a stream has enough queued to satisfy the preroll */
+static int stream_prerolled(VideoState *is, PacketQueue *q, AVStream *st) {
+  int64_t buffered_ms;
+
+  if(!q->nb_packets || (st == is->video_st && !is->video_keyframe_queued)) {
+    return 0;
+  }
+  if(is->preroll_ms <= 0) {
+    /* fast start: the first decodable packet is enough */
+    return 1;
+  }
+
+  buffered_ms = av_rescale_q(q->duration, st->time_base, (AVRational){1, 1000});
+  return buffered_ms >= is->preroll_ms;
+}
+
+static int preroll_complete(VideoState *is) {
+  if(is->eof ||
+     is->audioq.size >= MAX_AUDIOQ_SIZE ||
+     is->videoq.size >= MAX_VIDEOQ_SIZE) {
+    /* nothing more will be queued until playback starts */
+    return 1;
+  }
+  if(is->audio_st && !stream_prerolled(is, &is->audioq, is->audio_st)) {
+    return 0;
+  }
+  if(is->video_st && !stream_prerolled(is, &is->videoq, is->video_st)) {
+    return 0;
+  }
+  return 1;
+}
+
+/* Identifies the content for the probe cache: the url, its size and its first bytes */
+static uint64_t probe_signature(VideoState *is) {
+  uint8_t head[PROBE_SIGNATURE_SIZE];
+  struct stat st;
+  int64_t size = -1;
+  int n = 0;
+
+  if (is->fd != -1) {
+    /* the fd: name changes with every dup, only the content is stable */
+    if (fstat(is->fd, &st) == 0) {
+      size = st.st_size - is->offset;
+      if (is->length >= 0 && is->length < size) {
+        size = is->length;
+      }
+    }
+    n = pread(is->fd, head, sizeof(head), is->offset);
+    return probecache_key(NULL, head, n > 0 ? n : 0, size);
+  }
+
+  if (is->cache_io) {
+    size = avio_size(is->cache_io);
+    n = avio_read(is->cache_io, head, sizeof(head));
+    avio_seek(is->cache_io, 0, SEEK_SET);
+  } else if (is->io_context) {
+    size = avio_size(is->io_context);
+    /* live streams have no length and no stable first bytes */
+    if (size > 0) {
+      n = avio_read(is->io_context, head, sizeof(head));
+      /* still inside the I/O buffer when the stream is not seekable */
+      avio_seek(is->io_context, 0, SEEK_SET);
+    }
+  }
+  return probecache_key(is->filename, head, n > 0 ? n : 0, size);
+}
+
+/* Duration queued in the master stream, in microseconds */
+static int64_t queued_duration(VideoState *is) {
+  PacketQueue *q = is->audio_st ? &is->audioq : &is->videoq;
+  AVStream *st = is->audio_st ? is->audio_st : is->video_st;
+
+  return st ? av_rescale_q(q->duration, st->time_base, AV_TIME_BASE_Q) : 0;
+}
+
+/* How far ahead of playback the input has been read, as a percentage of the duration */
+static int buffered_percent(VideoState *is) {
+  int64_t queued, duration, target;
+  int percent;
+
+  if (is->eof) {
+    return 100;
+  }
+  if (!is->audio_st && !is->video_st) {
+    return 0;
+  }
+
+  queued = queued_duration(is);
+  duration = is->pFormatCtx->duration;
+  if (duration > 0) {
+    percent = (get_master_clock(is) * AV_TIME_BASE + queued) * 100 / duration;
+  } else {
+    /* live: how full the buffer is */
+    target = (int64_t) (is->preroll_ms > 0 ? is->preroll_ms : DEFAULT_PREROLL_MS) * 1000;
+    percent = queued * 100 / target;
+  }
+
+  return av_clip(percent, 0, 100);
+}
+
+/* Rate limited MEDIA_BUFFERING_UPDATE and bandwidth estimates for network sources */
+static void update_buffering(VideoState *is) {
+  int64_t now = av_gettime_relative();
+  int64_t bytes, time_us;
+  int percent, kbps;
+
+  if (!is->network || now - is->buffering_update_time < BUFFERING_UPDATE_INTERVAL) {
+    return;
+  }
+  is->buffering_update_time = now;
+
+  percent = buffered_percent(is);
+  if (percent != is->buffering_percent_sent) {
+    is->buffering_percent_sent = percent;
+    notify_from_thread(is, MEDIA_BUFFERING_UPDATE, percent, 0);
+  }
+
+  if (is->abr) {
+    /* the variant selection measures the segment downloads */
+    if ((kbps = abr_bandwidth(is->abr) / 1000) > 0) {
+      is->bandwidth_kbps = kbps;
+      notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_NETWORK_BANDWIDTH, kbps);
+    }
+    return;
+  }
+
+  if (!is->readahead_io) {
+    return;
+  }
+
+  /* only time spent waiting on the source counts, not time the buffer was full */
+  readahead_stats(is->readahead_io, &bytes, &time_us);
+  if (time_us - is->bandwidth_time < BANDWIDTH_MIN_SAMPLE) {
+    return;
+  }
+
+  kbps = (bytes - is->bandwidth_bytes) * 8000 / (time_us - is->bandwidth_time);
+  if (is->bandwidth_kbps) {
+    kbps = is->bandwidth_kbps + (kbps - is->bandwidth_kbps) * BANDWIDTH_SMOOTHING;
+  }
+  is->bandwidth_kbps = kbps;
+  is->bandwidth_bytes = bytes;
+  is->bandwidth_time = time_us;
+  notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_NETWORK_BANDWIDTH, kbps);
+}
+
+/*
+ * Follows the ICY metadata of a shoutcast stream. Only a new title is
+ * notified, with the keys that changed since the previous packet.
+ */
+static void update_icy_metadata(VideoState *is) {
+  int64_t now = av_gettime_relative();
+  AVDictionary *icy = NULL, *changed = NULL, *old;
+  AVDictionaryEntry *t = NULL, *prev;
+  char *packet;
+
+  if (!is->network || now - is->icy_update_time < ICY_UPDATE_INTERVAL) {
+    return;
+  }
+  is->icy_update_time = now;
+
+  /* io_context feeds the demuxer, directly or through the read-ahead */
+  if (!is->io_context || !(packet = get_shoutcast_metadata(is->io_context))) {
+    return;
+  }
+
+  /* only this thread writes icy_metadata, reading it needs no lock */
+  prev = av_dict_get(is->icy_metadata, ICY_METADATA, NULL, 0);
+  if (prev && !strcmp(prev->value, packet)) {
+    av_free(packet);
+    return;
+  }
+
+  parse_shoutcast_metadata(packet, &icy);
+  while ((t = av_dict_get(icy, "", t, AV_DICT_IGNORE_SUFFIX))) {
+    prev = av_dict_get(is->icy_metadata, t->key, NULL, 0);
+    if (!prev || strcmp(prev->value, t->value)) {
+      av_dict_set(&changed, t->key, t->value, 0);
+    }
+  }
+  av_dict_set(&icy, ICY_METADATA, packet, AV_DICT_DONT_STRDUP_VAL);
+
+  pthread_mutex_lock(&is->metadata_lock);
+  old = is->icy_metadata;
+  is->icy_metadata = icy;
+  pthread_mutex_unlock(&is->metadata_lock);
+  av_dict_free(&old);
+
+  if (!av_dict_get(changed, ICY_TITLE, NULL, 0)) {
+    av_dict_free(&changed);
+    return;
+  }
+
+  av_dict_set(&changed, ICY_METADATA, av_dict_get(icy, ICY_METADATA, NULL, 0)->value, 0);
+  notify_metadata_from_thread(is, changed);
+}
+
+/*
+ * Keeps a live stream near the target latency: plays slightly faster
+ * while it is behind, and drops queued packets when it is far behind.
+ * The latency is what is queued, plus what the read-ahead holds.
+ */
+static void live_catch_up(VideoState *is) {
+  int64_t target = (int64_t) is->live_latency_ms * 1000;
+  int64_t latency, excess, bytes;
+  float speed = 1.0f;
+
+  if (!is->live || !is->player_started || is->paused) {
+    return;
+  }
+
+  if (target) {
+    latency = queued_duration(is);
+    if (is->readahead_io && is->pFormatCtx->bit_rate > 0 &&
+        (bytes = readahead_buffered(is->readahead_io)) > 0) {
+      latency += bytes * 8 * AV_TIME_BASE / is->pFormatCtx->bit_rate;
+    }
+    excess = latency - target;
+
+    if (excess > LIVE_TRIM_THRESHOLD) {
+      /* too far behind to catch up by playing faster */
+      if (is->audio_st) {
+        packet_queue_trim(is, &is->audioq, av_rescale_q(target, AV_TIME_BASE_Q, is->audio_st->time_base), 0);
+      }
+      if (is->video_st) {
+        packet_queue_trim(is, &is->videoq, av_rescale_q(target, AV_TIME_BASE_Q, is->video_st->time_base), 1);
+      }
+    } else if (excess > LIVE_CATCHUP_THRESHOLD ||
+               (excess > 0 && is->catchup_speed > 1.0f)) {
+      /* in steps of 1%, the clock is republished on every change */
+      speed = FFMIN(roundf(100 * (1.0f + LIVE_CATCHUP_GAIN * excess / AV_TIME_BASE)) / 100,
+                    LIVE_MAX_CATCHUP);
+    }
+  }
+
+  if (speed != is->catchup_speed) {
+    is->catchup_speed = speed;
+    is->playback_speed = FFMIN(is->requested_speed * speed, MAX_PLAYBACK_SPEED);
+    republish_clock(is);
+  }
+}
+
+/* Reopens the connection under the demuxer and repositions it where reading stopped */
+static int reopen_input(VideoState *is) {
+  AVFormatContext *ic = is->pFormatCtx;
+  AVDictionary *options = NULL;
+  AVIOContext *source = NULL;
+  int readahead = is->readahead_io != NULL;
+  int64_t target;
+  int ret;
+
+  readahead_close(&is->readahead_io);
+
+  if (is->cache_io) {
+    /* the cache opens a new connection on its next read */
+    source = is->cache_io;
+    source->error = 0;
+    source->eof_reached = 0;
+  } else {
+    av_dict_copy(&options, is->io_opts, 0);
+    if (ic->flags & AVFMT_FLAG_CUSTOM_IO) {
+      ic->pb = NULL;
+      avio_closep(&is->io_context);
+      ret = avio_open2(&is->io_context, is->filename, AVIO_FLAG_READ, &ic->interrupt_callback, &options);
+      source = is->io_context;
+    } else {
+      avio_closep(&ic->pb);
+      ret = avio_open2(&ic->pb, is->filename, AVIO_FLAG_READ, &ic->interrupt_callback, &options);
+    }
+    av_dict_free(&options);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  if (source) {
+    if (readahead &&
+        (is->readahead_io = readahead_open(source, is->readahead_size, &ic->interrupt_callback))) {
+      source = is->readahead_io;
+    }
+    ic->pb = source;
+  }
+  is->bandwidth_bytes = 0;
+  is->bandwidth_time = 0;
+
+  is->resync_streams = (is->audioStream >= 0 ? 1 : 0) | (is->videoStream >= 0 ? 2 : 0);
+  if (!(ic->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+    /* live, pick up wherever the stream is now */
+    avformat_flush(ic);
+    is->resync = RESYNC_LIVE;
+    return 0;
+  }
+
+  if (is->read_pos >= 0 && !(ic->iformat->flags & AVFMT_NO_BYTE_SEEK)) {
+    ret = avformat_seek_file(ic, -1, INT64_MIN, is->read_pos, is->read_pos, AVSEEK_FLAG_BYTE);
+  } else {
+    if (is->audio_st && is->audio_next_dts != AV_NOPTS_VALUE) {
+      target = av_rescale_q(is->audio_next_dts, is->audio_st->time_base, AV_TIME_BASE_Q);
+    } else if (is->video_st && is->video_next_dts != AV_NOPTS_VALUE) {
+      target = av_rescale_q(is->video_next_dts, is->video_st->time_base, AV_TIME_BASE_Q);
+    } else {
+      target = get_master_clock(is) * AV_TIME_BASE;
+    }
+    ret = avformat_seek_file(ic, -1, INT64_MIN, target, target, 0);
+  }
+  is->resync = RESYNC_SEEK;
+
+  return ret < 0 ? ret : 0;
+}
+
+/*
+ * Called when reading failed on a network source. Reconnects with a
+ * growing delay while the queued packets play out, and gives up once
+ * the outage lasts longer than RECONNECT_TIMEOUT.
+ */
+static int reconnect(VideoState *is) {
+  int64_t delay;
+  int64_t deadline;
+  int ret;
+
+  if (!is->reconnect_start) {
+    is->reconnect_start = av_gettime_relative();
+  }
+
+  for (;;) {
+    delay = FFMIN((int64_t) RECONNECT_DELAY_MIN << FFMIN(is->reconnect_attempts, 8),
+                  (int64_t) RECONNECT_DELAY_MAX * 1000000);
+    deadline = av_gettime_relative() + delay;
+    if (deadline - is->reconnect_start > RECONNECT_TIMEOUT) {
+      return AVERROR(ETIMEDOUT);
+    }
+    while (!is->quit && av_gettime_relative() < deadline) {
+      SDL_Delay(10);
+    }
+    if (is->quit) {
+      return AVERROR_EXIT;
+    }
+
+    is->reconnect_attempts++;
+    fprintf(stderr, "%s: reconnecting, attempt %d\n", is->filename, is->reconnect_attempts);
+    if ((ret = reopen_input(is)) >= 0) {
+      return 0;
+    }
+  }
+}
+
+/*
+ * Keeps the packets read after a reconnect continuous with those read
+ * before it. Returns 0 if the packet was already queued and is dropped.
+ */
+static int resync_packet(VideoState *is, AVPacket *pkt) {
+  AVStream *st;
+  int64_t *next_dts;
+  int64_t offset;
+  int stream;
+
+  if (pkt->stream_index == is->audioStream) {
+    st = is->audio_st;
+    next_dts = &is->audio_next_dts;
+    stream = 1;
+  } else if (pkt->stream_index == is->videoStream) {
+    st = is->video_st;
+    next_dts = &is->video_next_dts;
+    stream = 2;
+  } else {
+    return 1;
+  }
+
+  if (is->resync == RESYNC_LIVE && pkt->dts != AV_NOPTS_VALUE) {
+    /* the new connection starts its own timeline, splice it onto the old one */
+    is->ts_offset = 0;
+    if (*next_dts != AV_NOPTS_VALUE) {
+      is->ts_offset = av_rescale_q(*next_dts - pkt->dts, st->time_base, AV_TIME_BASE_Q);
+    }
+    is->resync = RESYNC_NONE;
+  }
+
+  if (is->ts_offset) {
+    offset = av_rescale_q(is->ts_offset, AV_TIME_BASE_Q, st->time_base);
+    if (pkt->pts != AV_NOPTS_VALUE) {
+      pkt->pts += offset;
+    }
+    if (pkt->dts != AV_NOPTS_VALUE) {
+      pkt->dts += offset;
+    }
+  }
+
+  if (is->resync == RESYNC_SEEK && (is->resync_streams & stream)) {
+    if (pkt->dts != AV_NOPTS_VALUE && *next_dts != AV_NOPTS_VALUE &&
+        pkt->dts + pkt->duration <= *next_dts) {
+      return 0;
+    }
+    is->resync_streams &= ~stream;
+    if (!is->resync_streams) {
+      is->resync = RESYNC_NONE;
+    }
+  }
+
+  if (pkt->dts != AV_NOPTS_VALUE) {
+    *next_dts = pkt->dts + pkt->duration;
+  }
+  if (pkt->pos >= 0) {
+    is->read_pos = pkt->pos + pkt->size;
+  }
+  /* reading works again */
+  is->reconnect_start = 0;
+  is->reconnect_attempts = 0;
+
+  return 1;
+}
+
 int decode_thread(void *arg) {
 
   VideoState *is = (VideoState *)arg;
   AVPacket pkt1, *packet = &pkt1;
 
-  AVDictionary *io_dict = NULL;
   AVIOInterruptCB callback;
+  int readahead;
 
   int video_index = -1;
   int audio_index = -1;
   int i;
 
   int ret;
-  int eof = 0;
+  int switched = 0;
+
+  uint64_t probe_key = 0;
+  int probed = -1;
+
+  AVInputFormat *input_format = NULL;
+  AVDictionaryEntry *format;
 
   is->videoStream=-1;
   is->audioStream=-1;
 
+  is->network = is->fd == -1 && strstr(is->filename, "://") &&
+                !av_strstart(is->filename, "file:", NULL);
+  is->buffering_percent_sent = -1;
+  is->read_pos = -1;
+  is->audio_next_dts = AV_NOPTS_VALUE;
+  is->video_next_dts = AV_NOPTS_VALUE;
+
   AVDictionary *options = NULL;
   av_dict_set(&options, "icy", "1", 0);
   av_dict_set(&options, "user-agent", "FFmpegMediaPlayer", 0);
@@ -890,36 +2133,123 @@ int decode_thread(void *arg) {
     av_dict_set(&options, "headers", is->headers, 0);
   }
 
-  if (is->offset > 0) {
-    is->pFormatCtx = avformat_alloc_context();
-    is->pFormatCtx->skip_initial_bytes = is->offset;
-    //is->pFormatCtx->iformat = av_find_input_format("mp3");
+  if (is->network && is->live_latency_ms) {
+    /* start close to live, and without buffering during the probe */
+    av_dict_set(&options, "fflags", "nobuffer", 0);
+    av_dict_set_int(&options, "analyzeduration", LIVE_ANALYZE_DURATION, 0);
+    av_dict_set(&options, "live_start_index", "-1", 0);
+  }
+
+  if (is->network) {
+    /* let the http protocol retry short drops by itself */
+    av_dict_set(&options, "reconnect", "1", 0);
+    av_dict_set(&options, "reconnect_streamed", "1", 0);
+    av_dict_set_int(&options, "reconnect_delay_max", RECONNECT_DELAY_MAX, 0);
+  }
+
+  /* options set by the application override the defaults above */
+  av_dict_copy(&options, is->format_opts, 0);
+  if ((format = av_dict_get(options, "format", NULL, 0))) {
+    /* a known format skips the input format probe */
+    input_format = av_find_input_format(format->value);
+    av_dict_set(&options, "format", NULL, 0);
   }
+  av_dict_copy(&is->io_opts, options, 0);
+
+  /* a live stream read ahead only falls further behind */
+  readahead = is->readahead_size > 0 && !(is->network && is->live_latency_ms);
 
   // will interrupt blocking functions if we quit!
   callback.callback = decode_interrupt_cb;
   callback.opaque = is;
-  if (avio_open2(&is->io_context, is->filename, 0, &callback, &io_dict))
+  if (is->fd != -1) {
+    /* read the descriptor range directly, seekable unlike a pipe: */
+    is->fd_io = fdio_open(is->fd, is->offset, is->length);
+    is->pFormatCtx = avformat_alloc_context();
+    if (!is->fd_io || !is->pFormatCtx) {
+      fprintf(stderr, "Unable to open I/O for %s\n", is->filename);
+      prepare_failed(is);
+      return -1;
+    }
+    is->pFormatCtx->pb = is->fd_io;
+    is->pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    is->pFormatCtx->interrupt_callback = callback;
+  } else if (httpcache_enabled() &&
+             (is->cache_io = httpcache_open(is->filename, options, &callback))) {
+    is->pFormatCtx = avformat_alloc_context();
+    if (!is->pFormatCtx) {
+      prepare_failed(is);
+      return -1;
+    }
+    is->pFormatCtx->pb = is->cache_io;
+    is->pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    is->pFormatCtx->interrupt_callback = callback;
+  } else if (avio_open2(&is->io_context, is->filename, AVIO_FLAG_READ, &callback, &options))
   {
     fprintf(stderr, "Unable to open I/O for %s\n", is->filename);
-    notify_from_thread(is, MEDIA_ERROR, 0, 0);
+    prepare_failed(is);
     return -1;
   }
 
+  if (probecache_enabled()) {
+    probe_key = probe_signature(is);
+  }
+
+  if (!readahead && is->io_context) {
+    /* demux the connection that was opened with the options above */
+    if (!(is->pFormatCtx = avformat_alloc_context())) {
+      prepare_failed(is);
+      return -1;
+    }
+    is->pFormatCtx->pb = is->io_context;
+    is->pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    is->pFormatCtx->interrupt_callback = callback;
+  } else if (readahead) {
+    /* demux from memory while a thread keeps reading ahead of it */
+    AVIOContext *source = is->fd_io ? is->fd_io : is->cache_io ? is->cache_io : is->io_context;
+
+    is->readahead_io = readahead_open(source, is->readahead_size, &callback);
+    if (is->readahead_io) {
+      source = is->readahead_io;
+    }
+    if (!is->pFormatCtx && !(is->pFormatCtx = avformat_alloc_context())) {
+      prepare_failed(is);
+      return -1;
+    }
+    is->pFormatCtx->pb = source;
+    is->pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    is->pFormatCtx->interrupt_callback = callback;
+  }
+
   // Open video file
-  if(avformat_open_input(&is->pFormatCtx, is->filename, NULL, &options)!=0)
+  ret = avformat_open_input(&is->pFormatCtx, is->filename, input_format, &options);
+  av_dict_free(&options);
+  if(ret!=0)
   {
-	  notify_from_thread(is, MEDIA_ERROR, 0, 0);
+	  prepare_failed(is);
     return -1; // Couldn't open file
   }
 
+  if (probe_key) {
+    probed = probecache_load(probe_key, is->pFormatCtx);
+    if (probed == 0) {
+      /* the cache filled in most of it, a short probe does the rest */
+      is->pFormatCtx->probesize = PROBE_CACHE_PROBESIZE;
+      is->pFormatCtx->max_analyze_duration = PROBE_CACHE_ANALYZE_DURATION;
+    }
+  }
+
   // Retrieve stream information
-  if(avformat_find_stream_info(is->pFormatCtx, NULL)<0)
+  if(probed <= 0 && avformat_find_stream_info(is->pFormatCtx, NULL)<0)
   {
-	  notify_from_thread(is, MEDIA_ERROR, 0, 0);
+	  prepare_failed(is);
     return -1; // Couldn't find stream information
   }
 
+  if (probe_key && probed < 0) {
+    probecache_store(probe_key, is->pFormatCtx);
+  }
+
   // Dump information about file onto standard error
   av_dump_format(is->pFormatCtx, 0, is->filename, 0);
 
@@ -946,16 +2276,31 @@ int decode_thread(void *arg) {
   if(is->videoStream < 0 && is->audioStream < 0) {
   //if(is->videoStream < 0 || is->audioStream < 0) {
     fprintf(stderr, "%s: could not open codecs\n", is->filename);
-    notify_from_thread(is, MEDIA_ERROR, 0, 0);
+    prepare_failed(is);
     return 0;
   }
 
+  is->live = is->network && is->pFormatCtx->duration <= 0;
+
+  if (is->network) {
+    /* stops the unused variants of adaptive streams from downloading */
+    is->abr = abr_open(is->pFormatCtx, is->audioStream, is->videoStream);
+  }
+
   set_rotation(is->pFormatCtx, is->audio_st, is->video_st);
   set_framerate(is->pFormatCtx, is->audio_st, is->video_st);
   set_filesize(is->pFormatCtx);
   set_chapter_count(is->pFormatCtx);
   //set_video_dimensions(is->pFormatCtx, is->video_st);
 
+  if(is->audioStream < 0 && is->av_sync_type == AV_SYNC_AUDIO_MASTER) {
+    /* nothing to follow, let the video pace itself */
+    is->av_sync_type = AV_SYNC_VIDEO_MASTER;
+  }
+
+  init_gapless_trim(is);
+  init_loudness(is);
+
   notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_METADATA_UPDATE, 0);
 
   // main decode loop
@@ -983,6 +2328,7 @@ int decode_thread(void *arg) {
       if(ret < 0) {
 	fprintf(stderr, "%s: error while seeking\n", is->pFormatCtx->filename);
       } else {
+	is->eof = 0;
 	if(is->audioStream >= 0) {
 	  packet_queue_flush(&is->audioq);
 	  packet_queue_put(is, &is->audioq, &is->flush_pkt);
@@ -991,18 +2337,33 @@ int decode_thread(void *arg) {
 	  packet_queue_flush(&is->videoq);
 	  packet_queue_put(is, &is->videoq, &is->flush_pkt);
 	}
+	is->audio_next_dts = AV_NOPTS_VALUE;
+	is->video_next_dts = AV_NOPTS_VALUE;
+	publish_clock(is, (double)seek_target / AV_TIME_BASE);
 	notify_from_thread(is, MEDIA_SEEK_COMPLETE, 0, 0);
 
       }
       is->seek_req = 0;
-      eof = 0;
     }
 
-    if (is->audioq.size >= MAX_AUDIOQ_SIZE && !is->prepared) {
-        queueAudioSamples(&is->audio_player, is);
-
+    if (!is->prepared && preroll_complete(is) && prepare_done(is, 0)) {
         notify_from_thread(is, MEDIA_PREPARED, 0, 0);
-    	is->prepared = 1;
+    }
+
+    if (is->buffering && preroll_complete(is) &&
+        __atomic_exchange_n(&is->buffering, 0, __ATOMIC_ACQ_REL)) {
+        notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_BUFFERING_END, 0);
+    }
+
+    update_buffering(is);
+
+    update_icy_metadata(is);
+
+    live_catch_up(is);
+
+    if (is->abr) {
+      abr_update(is->abr, queued_duration(is),
+                 is->audioq.size > MAX_AUDIOQ_SIZE || is->videoq.size > MAX_VIDEOQ_SIZE);
     }
 
     if(is->audioq.size > MAX_AUDIOQ_SIZE ||
@@ -1010,35 +2371,81 @@ int decode_thread(void *arg) {
       SDL_Delay(10);
       continue;
     }
-    if((ret = av_read_frame(is->pFormatCtx, packet)) < 0) {
+    if(is->eof) {
+      /* wait for a seek or quit */
+      SDL_Delay(10);
+      continue;
+    }
+    ret = is->abr ? abr_read_frame(is->abr, packet, &switched) :
+                    av_read_frame(is->pFormatCtx, packet);
+    if(ret < 0) {
+      if (is->quit) {
+        /* interrupted, also by a prepare that timed out */
+        break;
+      }
+      if (is->network && is->pFormatCtx->pb &&
+          (is->pFormatCtx->pb->error ||
+           (ret == AVERROR_EOF && !(is->pFormatCtx->pb->seekable & AVIO_SEEKABLE_NORMAL)))) {
+        /* a live stream does not end, its connection was dropped */
+        if (reconnect(is) == 0) {
+          continue;
+        }
+        if (is->quit) {
+          break;
+        }
+        if (!is->pFormatCtx->pb || ret != AVERROR_EOF) {
+          fprintf(stderr, "%s: unable to reconnect\n", is->filename);
+          notify_from_thread(is, MEDIA_ERROR, MEDIA_ERROR_UNKNOWN, MEDIA_ERROR_IO);
+          break;
+        }
+      }
       if (ret == AVERROR_EOF || !is->pFormatCtx->pb->eof_reached) {
-          eof = 1;
-    	  break;
+          if (is->loop && loop_stream(is) == 0) {
+              continue;
+          }
+          /* with audio, playback completes once the audio path has
+             played everything that is queued */
+          packet_queue_eof(is);
+          if (is->audioStream < 0) {
+        	  notify_from_thread(is, MEDIA_PLAYBACK_COMPLETE, 0, 0);
+          }
+          continue;
       }
 
       if(is->pFormatCtx->pb->error == 0) {
 	SDL_Delay(100); /* no error; wait for user input */
 	continue;
       } else {
+	fprintf(stderr, "%s: error while reading\n", is->filename);
+	notify_from_thread(is, MEDIA_ERROR, MEDIA_ERROR_UNKNOWN, MEDIA_ERROR_IO);
 	break;
       }
     }
+    if (switched && is->audioStream >= 0) {
+      /* the audio of the new variant may start before where the old one stopped */
+      is->resync = RESYNC_SEEK;
+      is->resync_streams |= 1;
+    }
+    if (!resync_packet(is, packet)) {
+      av_packet_unref(packet);
+      continue;
+    }
     // Is this a packet from the video stream?
     if(packet->stream_index == is->videoStream) {
+      if(packet->flags & AV_PKT_FLAG_KEY) {
+        is->video_keyframe_queued = 1;
+      }
       packet_queue_put(is, &is->videoq, packet);
     } else if(packet->stream_index == is->audioStream) {
       packet_queue_put(is, &is->audioq, packet);
     } else {
       av_packet_unref(packet);
     }
-
-	if (eof) {
-		break;
-	}
   }
 
-  if (eof) {
-	  notify_from_thread(is, MEDIA_PLAYBACK_COMPLETE, 0, 0);
+  if (!is->prepared) {
+    /* quit or failed before enough was buffered */
+    prepare_done(is, UNKNOWN_ERROR);
   }
 
   one = 1;
@@ -1062,29 +2469,55 @@ VideoState * create() {
 	is = av_mallocz(sizeof(VideoState));
 	is->last_paused = -1;
 	is->stream_type = 3;
+	is->fd = -1;
+	is->length = -1;
+	is->playback_speed = 1.0f;
+	is->requested_speed = 1.0f;
+	is->catchup_speed = 1.0f;
+	is->clock_out = &is->clock;
+	is->left_volume = 1.0f;
+	is->right_volume = 1.0f;
+	is->loudness_gain = 1.0f;
+	is->buffering_percent = -1;
+	is->preroll_ms = DEFAULT_PREROLL_MS;
+	is->readahead_size = DEFAULT_READAHEAD_SIZE;
+	pthread_mutex_init(&is->prepare_lock, NULL);
+	pthread_cond_init(&is->prepare_cond, NULL);
+	pthread_mutex_init(&is->metadata_lock, NULL);
 
     return is;
 }
 
 VideoState * getNextMediaPlayer(VideoState **ps) {
-	/*VideoState *is = *ps;
-    
-    if (is && is->next) {
-        return is->next;
-    }*/
-    
-    return NULL;
+	VideoState *is = *ps;
+	VideoState *next = NULL;
+
+	if (is) {
+		pthread_mutex_lock(&next_player_lock);
+		next = is->next;
+		pthread_mutex_unlock(&next_player_lock);
+	}
+
+	return next;
 }
 
 void disconnect(VideoState **ps) {
 	VideoState *is = *ps;
 
 	if (is) {
+		unlink_next_player(is);
+		eventqueue_cancel(is);
+
 		if (is->pFormatCtx) {
 			avformat_close_input(&is->pFormatCtx);
 			is->pFormatCtx = NULL;
 		}
 
+		abr_close(&is->abr);
+		readahead_close(&is->readahead_io);
+		fdio_close(&is->fd_io);
+		httpcache_close(&is->cache_io);
+
 		if (is->audioq.initialized == 1) {
 			if (is->audioq.first_pkt) {
 				free(is->audioq.first_pkt);
@@ -1165,6 +2598,7 @@ void disconnect(VideoState **ps) {
 			avio_close(is->io_context);
 			is->io_context = NULL;
 		}
+		av_dict_free(&is->io_opts);
 
 		if (is->sws_ctx) {
 			sws_freeContext(is->sws_ctx);
@@ -1181,12 +2615,42 @@ void disconnect(VideoState **ps) {
 			is->audio_player = NULL;
 		}
 
+		if (is->time_stretch) {
+			timestretch_free(&is->time_stretch);
+		}
+
+		av_freep(&is->loop_cache);
+
+		if (is->audio_gain) {
+			audiogain_free(&is->audio_gain);
+		}
+
+		if (is->loudness) {
+			loudness_free(&is->loudness);
+		}
+
+		av_freep(&is->crossfade_buf);
+
+		av_dict_free(&is->format_opts);
+		av_dict_free(&is->icy_metadata);
+		av_dict_free(&is->metadata_update);
+
+		if (is->fd != -1) {
+			close(is->fd);
+			is->fd = -1;
+		}
+
 		if (is->tid) {
 			free(is->tid);
 			is->tid = NULL;
 		}
 
 	    av_packet_unref(&is->flush_pkt);
+	    av_packet_unref(&is->loop_pkt);
+
+		pthread_mutex_destroy(&is->prepare_lock);
+		pthread_cond_destroy(&is->prepare_cond);
+		pthread_mutex_destroy(&is->metadata_lock);
 
 		av_freep(&is);
 		*ps = NULL;
@@ -1227,11 +2691,12 @@ int setDataSourceFD(VideoState **ps, int fd, int64_t offset, int64_t length) {
 	int myfd = dup(fd);
 
 	char str[20];
-	sprintf(str, "pipe:%d", myfd);
+	sprintf(str, "fd:%d", myfd);
 	strncpy(is->filename, str, sizeof(is->filename));
 
 	is->fd = myfd;
 	is->offset = offset;
+	is->length = length;
 
 	*ps = is;
 
@@ -1254,7 +2719,7 @@ int setVideoSurface(VideoState **ps, void* native_window) {
 	return NO_ERROR;
 }
 
-int setListener(VideoState **ps, void* clazz, void (*listener) (void*, int, int, int, int)) {
+int setListener(VideoState **ps, void* clazz, void (*listener) (void*, int, int, int, int, AVDictionary*)) {
 	VideoState *is = *ps;
 
 	is->clazz = clazz;
@@ -1263,25 +2728,56 @@ int setListener(VideoState **ps, void* clazz, void (*listener) (void*, int, int,
 	return NO_ERROR;
 }
 
-int prepare(VideoState **ps) {
+int prepare(VideoState **ps, int timeout_ms) {
 	VideoState *is = *ps;
+	struct timespec deadline;
+	int ret = 0;
+	int status;
 
 	if (is->prepare_sync) {
 		return -EALREADY;
 	}
 	is->prepare_sync = 1;
-	int ret = prepareAsync_l(ps);
-	if (ret != NO_ERROR) {
-		return ret;
+	status = prepareAsync_l(ps);
+	if (status != NO_ERROR) {
+		is->prepare_sync = 0;
+		return status;
 	}
-	if (is->prepare_sync) {
-		while (!is->prepared) {
-			sleep(1);
+
+	if (timeout_ms > 0) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
 		}
+	}
 
-		is->prepare_sync = 0;
+	pthread_mutex_lock(&is->prepare_lock);
+	while (!is->prepared && !is->prepare_error && ret == 0) {
+		if (timeout_ms > 0) {
+			ret = pthread_cond_timedwait(&is->prepare_cond, &is->prepare_lock, &deadline);
+		} else {
+			pthread_cond_wait(&is->prepare_cond, &is->prepare_lock);
+		}
+	}
+
+	if (is->prepared) {
+		status = NO_ERROR;
+	} else if (is->prepare_error) {
+		status = is->prepare_error;
+	} else {
+		/* stop the decode thread, it must not report the outcome later */
+		is->prepare_abandoned = 1;
+		is->quit = 1;
+		status = TIMED_OUT;
 	}
-	return is->prepare_sync;
+	pthread_mutex_unlock(&is->prepare_lock);
+
+	is->prepare_sync = 0;
+
+	return status;
 }
 
 int prepareAsync(VideoState **ps) {
@@ -1291,10 +2787,19 @@ int prepareAsync(VideoState **ps) {
 int start(VideoState **ps) {
 	VideoState *is = *ps;
 
-	if (is && is->audio_player) {
+	if (is && is->prepared) {
 		is->paused = 0;
-	    is->player_started = 1;
-		setPlayingAudioPlayer(&is->audio_player, 0);
+		if (!is->player_started) {
+			is->player_started = 1;
+			// prime the buffer queue, the callback keeps it fed from then on
+			if (is->audio_player) {
+				queueAudioSamples(&is->audio_player);
+			}
+		}
+		republish_clock(is);
+		if (is->audio_player) {
+			setPlayingAudioPlayer(&is->audio_player, 0);
+		}
 		return NO_ERROR;
 	}
 
@@ -1305,6 +2810,7 @@ int stop(VideoState **ps) {
 	VideoState *is = *ps;
 
 	if (is) {
+	    unlink_next_player(is);
 	    is->quit = 1;
 	    /*
 	     * If the video has finished playing, then both the picture and
@@ -1347,9 +2853,12 @@ int stop(VideoState **ps) {
 int pause_l(VideoState **ps) {
 	VideoState *is = *ps;
 
-	if (is && is->audio_player) {
+	if (is && is->prepared) {
 		is->paused = !is->paused;
-		setPlayingAudioPlayer(&is->audio_player, 1);
+		republish_clock(is);
+		if (is->audio_player) {
+			setPlayingAudioPlayer(&is->audio_player, 1);
+		}
 		return NO_ERROR;
 	}
 
@@ -1403,7 +2912,13 @@ int getCurrentPosition(VideoState **ps, int *msec) {
 	VideoState *is = *ps;
 
 	if (is) {
-		*msec = is->audio_clock * 1000;
+		double pts;
+
+		if (clock_snapshot_read(is->clock_out, &pts) == 0) {
+			*msec = pts * 1000;
+		} else {
+			*msec = is->audio_clock * 1000;
+		}
 		return NO_ERROR;
 	}
 
@@ -1418,6 +2933,7 @@ int reset(VideoState **ps) {
 	VideoState *is = *ps;
 
 	if (is) {
+	    unlink_next_player(is);
 	    is->quit = 1;
 	    /*
 	     * If the video has finished playing, then both the picture and
@@ -1469,6 +2985,7 @@ int setLooping(VideoState **ps, int loop) {
 	VideoState *is = *ps;
 
 	if (is) {
+		is->loop = loop;
 		return NO_ERROR;
 	}
 
@@ -1479,7 +2996,7 @@ int isLooping(VideoState **ps) {
 	VideoState *is = *ps;
 
 	if (is) {
-		return NO_ERROR;
+		return is->loop;
 	}
 
 	return INVALID_OPERATION;
@@ -1488,60 +3005,289 @@ int isLooping(VideoState **ps) {
 int setVolume(VideoState **ps, float leftVolume, float rightVolume) {
 	VideoState *is = *ps;
 
-	if (is && is->audio_player) {
-		setVolumeUriAudioPlayer(&is->audio_player, leftVolume);
+	if (is) {
+		/* applied in software by gain_audio, the OpenSL player stays at 0 mB */
+		is->left_volume = leftVolume;
+		is->right_volume = rightVolume;
+		__atomic_store_n(&is->volume_changed, 1, __ATOMIC_RELEASE);
 		return NO_ERROR;
 	}
 
 	return INVALID_OPERATION;
 }
 
-static Uint32 notify_from_thread_cb(Uint32 interval, void *opaque) {
-    Message *message = (Message*) opaque;
+int setPlaybackSpeed(VideoState **ps, float speed) {
+	VideoState *is = *ps;
 
-    if (!message) {
-    	return 0;
-    }
+	if (!is) {
+		return INVALID_OPERATION;
+	}
 
-    if (message->is && message->is->notify_callback) {
-	    message->is->notify_callback(message->is->clazz, message->msg, message->ext1, message->ext2, message->from_thread);
-    }
+	if (speed < MIN_PLAYBACK_SPEED || speed > MAX_PLAYBACK_SPEED) {
+		return BAD_VALUE;
+	}
+
+	is->requested_speed = speed;
+	is->playback_speed = FFMIN(speed * is->catchup_speed, MAX_PLAYBACK_SPEED);
+	republish_clock(is);
+
+	return NO_ERROR;
+}
+
+int setLoudnessNormalization(VideoState **ps, int mode) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	if (mode < LOUDNESS_NORMALIZATION_OFF || mode > LOUDNESS_NORMALIZATION_ALBUM) {
+		return BAD_VALUE;
+	}
+
+	/* the audio thread owns the meter and the gain */
+	is->loudness_mode = mode;
+	__atomic_store_n(&is->loudness_mode_changed, 1, __ATOMIC_RELEASE);
+
+	return NO_ERROR;
+}
+
+/* Publishes the playback position to a snapshot owned by the caller, so
+   it can be read without holding on to the VideoState */
+int setClockSnapshot(VideoState **ps, ClockSnapshot *clock) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	is->clock_out = clock ? clock : &is->clock;
+	clock_snapshot_write(is->clock_out, 0, 0, 1.0f, 1);
+
+	return NO_ERROR;
+}
+
+int setCrossfadeDuration(VideoState **ps, int msec) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	if (msec < 0 || msec > MAX_CROSSFADE_MS) {
+		return BAD_VALUE;
+	}
+
+	is->crossfade_ms = msec;
+
+	return NO_ERROR;
+}
+
+int setProbeCacheDirectory(const char *path) {
+	return probecache_set_directory(path) == 0 ? NO_ERROR : BAD_VALUE;
+}
+
+int setOption(VideoState **ps, const char *key, const char *value) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	if (!key || !*key) {
+		return BAD_VALUE;
+	}
+
+	if (!strcmp(key, "format") && value && !av_find_input_format(value)) {
+		return BAD_VALUE;
+	}
+
+	// a NULL value removes the option
+	if (av_dict_set(&is->format_opts, key, value, 0) < 0) {
+		return NO_MEMORY;
+	}
 
-    free(message);
+	return NO_ERROR;
+}
+
+int setHttpCacheDirectory(const char *path, int64_t max_size) {
+	return httpcache_set_directory(path, max_size) == 0 ? NO_ERROR : BAD_VALUE;
+}
+
+int setReadAheadSize(VideoState **ps, int bytes) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	if (bytes < 0 || bytes > MAX_READAHEAD_SIZE) {
+		return BAD_VALUE;
+	}
+
+	is->readahead_size = bytes;
+
+	return NO_ERROR;
+}
+
+int setPreroll(VideoState **ps, int msec) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	if (msec < 0 || msec > MAX_PREROLL_MS) {
+		return BAD_VALUE;
+	}
+
+	is->preroll_ms = msec;
+
+	return NO_ERROR;
+}
+
+int setLiveLatency(VideoState **ps, int msec) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	if (msec < 0 || msec > MAX_LIVE_LATENCY_MS) {
+		return BAD_VALUE;
+	}
+
+	is->live_latency_ms = msec;
+
+	return NO_ERROR;
+}
+
+static void deliver_event(void *target, int msg, int ext1, int ext2) {
+	VideoState *is = (VideoState *) target;
+
+	if (is->notify_callback) {
+		is->notify_callback(is->clazz, msg, ext1, ext2, 1, NULL);
+	}
+}
+
+static void deliver_buffering_update(void *target, int msg, int ext1, int ext2) {
+	VideoState *is = (VideoState *) target;
+
+	// report the newest percentage, later updates queue a new event
+	ext1 = __atomic_exchange_n(&is->buffering_percent, -1, __ATOMIC_ACQ_REL);
+	deliver_event(target, msg, ext1, ext2);
+}
+
+static void deliver_metadata_update(void *target, int msg, int ext1, int ext2) {
+	VideoState *is = (VideoState *) target;
+	AVDictionary *changed;
+
+	// already delivered with an earlier event
+	if (!(changed = __atomic_exchange_n(&is->metadata_update, NULL, __ATOMIC_ACQ_REL))) {
+		return;
+	}
 
-    return 0; /* 0 means stop timer */
+	if (is->notify_callback) {
+		is->notify_callback(is->clazz, msg, ext1, ext2, 1, changed);
+	}
+	av_dict_free(&changed);
 }
 
 void notify(VideoState *is, int msg, int ext1, int ext2) {
 	if (is->notify_callback) {
-		is->notify_callback(is->clazz, msg, ext1, ext2, 0);
+		is->notify_callback(is->clazz, msg, ext1, ext2, 0, NULL);
 	}
 }
 
 void notify_from_thread(VideoState *is, int msg, int ext1, int ext2) {
-	Message* message = malloc(sizeof(Message));
-	message->is = is;
-	message->msg = msg;
-	message->ext1 = ext1;
-	message->ext2 = ext2;
-	message->from_thread = 1;
+	if (msg == MEDIA_BUFFERING_UPDATE) {
+		// coalesce with an update that has not been delivered yet
+		if (__atomic_exchange_n(&is->buffering_percent, ext1, __ATOMIC_ACQ_REL) >= 0) {
+			return;
+		}
+
+		if (eventqueue_post(is, deliver_buffering_update, msg, ext1, ext2) < 0) {
+			__atomic_store_n(&is->buffering_percent, -1, __ATOMIC_RELEASE);
+		}
+		return;
+	}
+
+	if (eventqueue_post(is, deliver_event, msg, ext1, ext2) < 0) {
+		fprintf(stderr, "Event queue full, dropped event %d\n", msg);
+	}
+}
+
+/* Sends MEDIA_INFO_METADATA_UPDATE with the changed keys, takes ownership of changed */
+void notify_metadata_from_thread(VideoState *is, AVDictionary *changed) {
+	AVDictionary *pending;
+
+	// merge with an update that has not been delivered yet
+	if ((pending = __atomic_exchange_n(&is->metadata_update, NULL, __ATOMIC_ACQ_REL))) {
+		av_dict_copy(&pending, changed, 0);
+		av_dict_free(&changed);
+		changed = pending;
+	}
+	__atomic_store_n(&is->metadata_update, changed, __ATOMIC_RELEASE);
 
-	SDL_AddTimer(0, notify_from_thread_cb, message);
+	// on failure the keys stay pending and go out with the next update
+	if (eventqueue_post(is, deliver_metadata_update, MEDIA_INFO, MEDIA_INFO_METADATA_UPDATE, 0) < 0) {
+		fprintf(stderr, "Event queue full, delayed metadata update\n");
+	}
 }
 
 int setNextPlayer(VideoState **ps, VideoState *next) {
-    /*VideoState *is = *ps;
-    
-    if (is) {
-        is->next = next;
-        return NO_ERROR;
-    }*/
-    
-    return NO_ERROR; //INVALID_OPERATION;
+	VideoState *is = *ps;
+
+	if (!is || is == next) {
+		return INVALID_OPERATION;
+	}
+
+	pthread_mutex_lock(&next_player_lock);
+	if (is->crossfade_next && is->crossfade_next != next) {
+		/* too late to replace the player being faded in */
+		pthread_mutex_unlock(&next_player_lock);
+		return INVALID_OPERATION;
+	}
+	if (is->next) {
+		is->next->prev = NULL;
+	}
+	if (next) {
+		if (next->prev) {
+			next->prev->next = NULL;
+		}
+		next->prev = is;
+	}
+	is->next = next;
+	pthread_mutex_unlock(&next_player_lock);
+
+	return NO_ERROR;
+}
+
+/* Called by the MediaPlayer once it is told it was started as the next
+   player. Starts its own output unless the previous player already plays
+   it through the running one */
+int startAsNext(VideoState **ps) {
+	VideoState *is = *ps;
+	int started;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	pthread_mutex_lock(&next_player_lock);
+	started = is->player_started;
+	pthread_mutex_unlock(&next_player_lock);
+
+	if (started) {
+		return NO_ERROR;
+	}
+
+	return start(ps);
 }
 
 void clear_l(VideoState **ps) {
 	VideoState *is = *ps;
+	AVDictionary *old_update;
 
 	if (is) {
 		if (is->pFormatCtx) {
@@ -1549,6 +3295,11 @@ void clear_l(VideoState **ps) {
 			is->pFormatCtx = NULL;
 		}
 
+		abr_close(&is->abr);
+		readahead_close(&is->readahead_io);
+		fdio_close(&is->fd_io);
+		httpcache_close(&is->cache_io);
+
 		is->videoStream = 0;
 		is->audioStream = 0;
 
@@ -1673,6 +3424,7 @@ void clear_l(VideoState **ps) {
 	    	avio_close(is->io_context);
 	    	is->io_context = NULL;
 	    }
+	    av_dict_free(&is->io_opts);
 
 	    if (is->sws_ctx) {
 	    	sws_freeContext(is->sws_ctx);
@@ -1689,18 +3441,43 @@ void clear_l(VideoState **ps) {
 	    	is->audio_player = NULL;
 	    }
 
+	    if (is->time_stretch) {
+	    	timestretch_free(&is->time_stretch);
+	    }
+
+	    if (is->audio_gain) {
+	    	audiogain_free(&is->audio_gain);
+	    }
+
+	    if (is->loudness) {
+	    	loudness_free(&is->loudness);
+	    }
+	    is->loudness_blocks = 0;
+	    is->loudness_gain = 1.0f;
+	    is->replaygain_track = 0;
+	    is->replaygain_album = 0;
+
+	    av_freep(&is->crossfade_buf);
+	    is->crossfade_buf_size = 0;
+
+	    clock_snapshot_write(is->clock_out, 0, 0, 1.0f, 1);
+	    is->crossfade_next = NULL;
+	    is->crossfade_pos = 0;
+	    is->crossfade_frames = 0;
+
+	    av_freep(&is->loop_cache);
+	    is->loop_cache_size = 0;
+	    is->loop_cache_ready = 0;
+	    is->loop_cache_pts = 0;
+	    is->loop_skip_pts = 0;
+
 	    //is->audio_callback = NULL;
 	    is->prepared = 0;
+	    is->prepare_error = 0;
+	    is->prepare_abandoned = 0;
 
 	    //is->headers[0] = '\0';
 
-	    if (is->fd != -1) {
-		    close(is->fd);
-        }
-
-	    is->fd = -1;
-	    is->offset = 0;
-
 	    is->prepare_sync = 0;
 
 	    //is->notify_callback = NULL;
@@ -1712,7 +3489,37 @@ void clear_l(VideoState **ps) {
 	    is->last_paused = -1;
 	    is->player_started = 0;
 
+	    is->eof = 0;
+	    is->video_keyframe_queued = 0;
+	    is->buffering = 0;
+	    is->buffering_update_time = 0;
+	    is->bandwidth_bytes = 0;
+	    is->bandwidth_time = 0;
+	    is->bandwidth_kbps = 0;
+	    is->resync = RESYNC_NONE;
+	    is->resync_streams = 0;
+	    is->ts_offset = 0;
+	    is->reconnect_start = 0;
+	    is->reconnect_attempts = 0;
+	    is->live = 0;
+
+	    pthread_mutex_lock(&is->metadata_lock);
+	    av_dict_free(&is->icy_metadata);
+	    pthread_mutex_unlock(&is->metadata_lock);
+	    is->icy_update_time = 0;
+	    old_update = __atomic_exchange_n(&is->metadata_update, NULL, __ATOMIC_ACQ_REL);
+	    av_dict_free(&old_update);
+	    if (is->catchup_speed != 1.0f) {
+	    	is->catchup_speed = 1.0f;
+	    	is->playback_speed = is->requested_speed;
+	    }
+	    is->audio_drained = 0;
+	    is->audio_complete = 0;
+	    is->audio_start_pts = 0;
+	    is->audio_end_pts = 0;
+
 	    av_packet_unref(&is->flush_pkt);
+	    av_packet_unref(&is->loop_pkt);
 	}
 }
 
@@ -1752,6 +3559,9 @@ int prepareAsync_l(VideoState **ps) {
     	av_init_packet(&is->flush_pkt);
     	is->flush_pkt.data = (unsigned char *)"FLUSH";
 
+    	av_init_packet(&is->loop_pkt);
+    	is->loop_pkt.data = (unsigned char *)"LOOP";
+
     	return NO_ERROR;
     }
     return INVALID_OPERATION;
@@ -1786,10 +3596,101 @@ int getMetadata(VideoState **ps, AVDictionary **metadata) {
     }
     
     get_metadata_internal(state->pFormatCtx, metadata);
+
+    pthread_mutex_lock(&state->metadata_lock);
+    av_dict_copy(metadata, state->icy_metadata, 0);
+    pthread_mutex_unlock(&state->metadata_lock);
     
     return SUCCESS;
 }
 
+/* Aborts a probeMetadata call once its deadline has passed */
+static int probe_interrupt_cb(void *opaque) {
+	return av_gettime_relative() > *(int64_t *) opaque;
+}
+
+/*
+ * Reads the tags of a source without a player: opens the container, fills
+ * in metadata and closes it again. No thread or output is set up. For
+ * containers without a header or without a duration the packets are
+ * probed briefly, which opens the decoders for as long as that takes.
+ * Gives up after METADATA_TIMEOUT, whatever is blocking.
+ */
+int probeMetadata(const char *url, AVDictionary **metadata) {
+	AVFormatContext *ic = NULL;
+	AVDictionary *options = NULL;
+	AVStream *audio_st = NULL;
+	AVStream *video_st = NULL;
+	AVStream *st;
+	int64_t duration = AV_NOPTS_VALUE;
+	int64_t deadline;
+	int i, ret;
+
+	if (!url || !metadata) {
+		return FAILURE;
+	}
+
+	ic = avformat_alloc_context();
+	if (!ic) {
+		return FAILURE;
+	}
+	deadline = av_gettime_relative() + METADATA_TIMEOUT;
+	ic->interrupt_callback.callback = probe_interrupt_cb;
+	ic->interrupt_callback.opaque = &deadline;
+
+	av_dict_set(&options, "icy", "1", 0);
+	av_dict_set(&options, "user-agent", "FFmpegMediaPlayer", 0);
+
+	ret = avformat_open_input(&ic, url, NULL, &options);
+	av_dict_free(&options);
+	if (ret != 0) {
+		fprintf(stderr, "%s: could not open for metadata\n", url);
+		return FAILURE;
+	}
+
+	// the header usually has the stream durations but not the total
+	if (ic->duration == AV_NOPTS_VALUE) {
+		for (i = 0; i < ic->nb_streams; i++) {
+			st = ic->streams[i];
+			if (st->duration != AV_NOPTS_VALUE) {
+				duration = FFMAX(duration, av_rescale_q(st->duration, st->time_base, AV_TIME_BASE_Q));
+			}
+		}
+		ic->duration = duration;
+	}
+
+	if ((ic->ctx_flags & AVFMTCTX_NOHEADER) || ic->duration == AV_NOPTS_VALUE) {
+		ic->probesize = METADATA_PROBESIZE;
+		ic->max_analyze_duration = METADATA_ANALYZE_DURATION;
+		avformat_find_stream_info(ic, NULL);
+	}
+
+	for (i = 0; i < ic->nb_streams; i++) {
+		st = ic->streams[i];
+		if (st->codec->codec_type == AVMEDIA_TYPE_AUDIO && !audio_st) {
+			audio_st = st;
+		} else if (st->codec->codec_type == AVMEDIA_TYPE_VIDEO && !video_st &&
+		           !(st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+			video_st = st;
+		}
+
+		set_codec(ic, i);
+	}
+
+	set_duration(ic);
+	set_rotation(ic, audio_st, video_st);
+	set_framerate(ic, audio_st, video_st);
+	set_filesize(ic);
+	set_chapter_count(ic);
+	set_video_dimensions(ic, video_st);
+
+	get_metadata_internal(ic, metadata);
+
+	avformat_close_input(&ic);
+
+	return SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
 
 }
@@ -38,6 +38,14 @@
 #include <pthread.h>
 #include "audioplayer.h"
 #include "videoplayer.h"
+#include "timestretch.h"
+#include "audiogain.h"
+#include "loudness.h"
+#include "eventqueue.h"
+#include "fdio.h"
+#include "httpcache.h"
+#include "readahead.h"
+#include "abr.h"
 #include <unistd.h>
 #include "Errors.h"
 
@@ -47,6 +55,24 @@
 #define MAX_AUDIO_FRAME_SIZE 192000
 #define MAX_AUDIOQ_SIZE (5 * 16 * 1024)
 #define MAX_VIDEOQ_SIZE (5 * 256 * 1024)
+#define DEFAULT_PREROLL_MS 300
+#define MAX_PREROLL_MS 10000
+#define BUFFERING_UPDATE_INTERVAL 1000000  /* microseconds between percentage updates */
+#define BANDWIDTH_MIN_SAMPLE 200000        /* microseconds of reading per bandwidth estimate */
+#define BANDWIDTH_SMOOTHING 0.3
+#define ICY_UPDATE_INTERVAL 500000         /* microseconds between checks for new ICY metadata */
+#define METADATA_PROBESIZE 65536           /* bytes read when probeMetadata needs the packets */
+#define METADATA_ANALYZE_DURATION 100000
+#define METADATA_TIMEOUT 10000000          /* microseconds before probeMetadata gives up on a source */
+#define MAX_LIVE_LATENCY_MS 60000
+#define LIVE_CATCHUP_THRESHOLD 500000     /* microseconds behind the target before speeding up */
+#define LIVE_CATCHUP_GAIN 0.05            /* extra speed per second behind the target */
+#define LIVE_MAX_CATCHUP 1.1f
+#define LIVE_TRIM_THRESHOLD 5000000       /* microseconds behind the target before dropping packets */
+#define LIVE_ANALYZE_DURATION 500000
+#define RECONNECT_DELAY_MIN 500000         /* microseconds before the first reconnect */
+#define RECONNECT_DELAY_MAX 5              /* seconds, also passed to the http protocol */
+#define RECONNECT_TIMEOUT 60000000         /* microseconds of failed reconnects before giving up */
 #define AV_SYNC_THRESHOLD 0.01
 #define AV_NOSYNC_THRESHOLD 10.0
 #define SAMPLE_CORRECTION_PERCENT_MAX 10
@@ -55,7 +81,17 @@
 #define FF_REFRESH_EVENT (24 + 1)
 #define FF_QUIT_EVENT (24 + 2)
 #define VIDEO_PICTURE_QUEUE_SIZE 1
-#define DEFAULT_AV_SYNC_TYPE AV_SYNC_VIDEO_MASTER
+#define AUDIO_EOF (-2)
+#define AUDIO_EMPTY (-3)  /* no packet queued yet, only returned when not blocking */
+#define MAX_CROSSFADE_MS 12000
+#define MAX_CLOCK_EXTRAPOLATION 0.25  /* seconds a clock snapshot may be extrapolated */
+#define LOUDNESS_REFERENCE (-18.0)   /* LUFS, the ReplayGain 2.0 reference level */
+#define LOUDNESS_MIN_BLOCKS 30        /* measure 3 seconds before normalizing untagged audio */
+#define LOUDNESS_UPDATE_BLOCKS 10     /* then update the gain every second */
+#define LOOP_CACHE_DURATION 1.0   /* seconds of decoded audio kept from the start of a looping clip */
+#define LOOP_CACHE_MAX_CLIP 30    /* only clips up to this many seconds keep a loop cache */
+#define LOOP_PREROLL 0.1          /* seconds decoded before the end of the loop cache after a loop seek */
+#define DEFAULT_AV_SYNC_TYPE AV_SYNC_AUDIO_MASTER
 
 typedef enum media_event_type {
     MEDIA_NOP               = 0, // interface test message
@@ -69,6 +105,7 @@ typedef enum media_event_type {
 
 typedef enum media_info_type {
 	MEDIA_INFO_UNKNOWN               = 0,
+	MEDIA_INFO_STARTED_AS_NEXT       = 2,
 	MEDIA_INFO_VIDEO_TRACK_LAGGING   = 700,
 	MEDIA_INFO_VIDEO_RENDERING_START = 3,
 	MEDIA_INFO_BUFFERING_START       = 701,
@@ -81,9 +118,16 @@ typedef enum media_info_type {
 	MEDIA_INFO_SUBTITLE_TIMED_OUT    = 902,
 } media_info_type;
 
+typedef enum loudness_normalization_mode {
+	LOUDNESS_NORMALIZATION_OFF   = 0,
+	LOUDNESS_NORMALIZATION_TRACK = 1,
+	LOUDNESS_NORMALIZATION_ALBUM = 2,
+} loudness_normalization_mode;
+
 typedef int media_error_type;
 static const media_error_type MEDIA_ERROR_UNKNOWN = 1;
 static const media_error_type MEDIA_ERROR_SERVER_DIED = 100;
+static const media_error_type MEDIA_ERROR_IO = -1004;
 
 typedef enum {
     MEDIA_PLAYER_STATE_ERROR        = 0,
@@ -97,6 +141,20 @@ typedef enum {
     MEDIA_PLAYER_PLAYBACK_COMPLETE  = 1 << 7
 } media_player_states;
 
+/*
+ * Playback position published by the player threads. Readers never lock,
+ * a sequence count that is odd while a write is in progress lets them
+ * retry instead of seeing a torn snapshot.
+ */
+typedef struct ClockSnapshot {
+  uint32_t seq;
+  int      valid;
+  int      paused;
+  float    rate;      /* stream seconds per wall second */
+  double   pts;       /* stream time at the anchor */
+  int64_t  time;      /* av_gettime_relative() at the anchor */
+} ClockSnapshot;
+
 typedef struct PacketQueue {
   SDL_Window     *screen;
   SDL_Renderer *renderer;
@@ -105,6 +163,7 @@ typedef struct PacketQueue {
   AVPacketList *first_pkt, *last_pkt;
   int nb_packets;
   int size;
+  int64_t duration;      /* sum of the queued packet durations, in stream time base */
   SDL_mutex *mutex;
   SDL_cond *cond;
 } PacketQueue;
@@ -181,10 +240,22 @@ typedef struct VideoState {
 
   int fd;
   int64_t offset;
+  int64_t length;                         /* of the descriptor range, -1 up to the end of the file */
+  AVIOContext     *fd_io;                 /* reads fd when the source is a descriptor */
+  AVIOContext     *cache_io;              /* reads http sources through the download cache */
+  AVIOContext     *readahead_io;          /* prefetches whichever source is in use */
+  int             readahead_size;         /* bytes kept ahead of the demuxer, 0 to read directly */
+  Abr             *abr;                   /* selects the HLS or DASH variant, NULL for other sources */
+  int             live_latency_ms;        /* target latency behind a live stream, 0 to buffer freely */
+  int             live;                   /* the source is a live network stream */
 
   int prepare_sync;
+  pthread_mutex_t prepare_lock;
+  pthread_cond_t  prepare_cond;           /* signalled once prepared or failed */
+  int             prepare_error;
+  int             prepare_abandoned;      /* a timed out prepare gave up, the outcome is not reported */
 
-  void (*notify_callback) (void*, int, int, int, int);
+  void (*notify_callback) (void*, int, int, int, int, AVDictionary*);
   void* clazz;
 
   int read_pause_return;
@@ -195,11 +266,86 @@ typedef struct VideoState {
   pthread_t       *tid;
   int player_started;
   AVPacket flush_pkt;
-  void *next;
+  struct VideoState *next;
+  struct VideoState *prev;
+
+  int             eof;              /* demuxer reached the end of the input */
+  int             audio_drained;    /* decoder has returned its last frame */
+  int             audio_complete;   /* MEDIA_PLAYBACK_COMPLETE sent from the audio path */
+  double          audio_start_pts;  /* gapless: audio before this pts is encoder delay */
+  double          audio_end_pts;    /* gapless: audio after this pts is padding, 0 if unknown */
+
+  int             loop;
+  AVPacket        loop_pkt;
+  uint8_t         *loop_cache;      /* decoded audio from the start of a short looping clip */
+  int             loop_cache_size;
+  int             loop_cache_ready;
+  double          loop_cache_pts;   /* pts of the first cached sample */
+  double          loop_skip_pts;    /* audio before this pts was already played from the cache */
 
   void *native_window;
 
   int stream_type;
+
+  float           playback_speed;         /* requested_speed times catchup_speed */
+  float           requested_speed;        /* set with setPlaybackSpeed */
+  float           catchup_speed;          /* above 1 while a live stream catches up */
+  TimeStretch     *time_stretch;
+
+  float           left_volume;
+  float           right_volume;
+  int             volume_changed;         /* set by setVolume, the audio thread updates the gain stage */
+  AudioGain       *audio_gain;
+
+  int             loudness_mode;
+  int             loudness_mode_changed;  /* set by setLoudnessNormalization, the audio thread updates the gain */
+  int             replaygain_track;       /* the track gain and peak were found in the tags */
+  int             replaygain_album;       /* the album gain and peak were found in the tags */
+  float           replaygain_track_gain;  /* dB */
+  float           replaygain_track_peak;  /* linear, 0 if unknown */
+  float           replaygain_album_gain;
+  float           replaygain_album_peak;
+  Loudness        *loudness;              /* measures untagged audio while it plays */
+  int             loudness_blocks;        /* blocks measured since the gain was updated */
+  float           loudness_gain;          /* linear, applied on top of the volume */
+
+  int             crossfade_ms;           /* crossfade into the next player, 0 for a gapless handover */
+  struct VideoState *crossfade_next;      /* next player mixed into the tail of this one */
+  int             crossfade_frames;       /* output frames the crossfade lasts */
+  int             crossfade_pos;
+  uint8_t         *crossfade_buf;         /* output of the next player before mixing */
+  int             crossfade_buf_size;
+  int             crossfade_refs;         /* pins held while the previous player mixes this one in */
+
+  ClockSnapshot   clock;                  /* published position, unless setClockSnapshot was called */
+  ClockSnapshot   *clock_out;             /* where the position is published */
+
+  int             buffering_percent;      /* pending buffering update, -1 if none is queued */
+
+  AVDictionary    *format_opts;           /* set with setOption, passed to avformat_open_input */
+
+  int             preroll_ms;             /* buffered per stream before prepared, 0 for fast start */
+  int             buffering;              /* playback ran dry, between BUFFERING_START and END */
+  int             network;                /* the source is read over the network */
+  int64_t         buffering_update_time;
+  int             buffering_percent_sent;
+  int64_t         bandwidth_bytes;        /* read-ahead totals at the last estimate */
+  int64_t         bandwidth_time;
+  int             bandwidth_kbps;         /* smoothed */
+  AVDictionary    *io_opts;               /* the options the source was opened with, to reconnect */
+  int64_t         read_pos;               /* byte offset after the last packet read */
+  int64_t         audio_next_dts;         /* expected dts of the next packet, in stream time base */
+  int64_t         video_next_dts;
+  int             resync;                 /* RESYNC_* after a reconnect */
+  int             resync_streams;         /* 1 audio, 2 video: streams still dropping packets */
+  int64_t         ts_offset;              /* added to live timestamps after a reconnect, AV_TIME_BASE */
+  int64_t         reconnect_start;        /* of the current outage, 0 while connected */
+  int             reconnect_attempts;
+  int             video_keyframe_queued;
+  pthread_mutex_t metadata_lock;          /* guards icy_metadata */
+  AVDictionary    *icy_metadata;          /* the last ICY packet and the keys parsed from it */
+  int64_t         icy_update_time;
+  AVDictionary    *metadata_update;       /* changed keys waiting for the event dispatcher */
 } VideoState;
 
 struct AVDictionary {
@@ -207,13 +353,11 @@ struct AVDictionary {
 	AVDictionaryEntry *elems;
 };
 
-typedef struct Message {
-	VideoState* is;
-	int msg;
-	int ext1;
-	int ext2;
-	int from_thread;
-} Message;
+enum {
+  RESYNC_NONE,
+  RESYNC_SEEK,     /* drop packets that were already queued before the connection dropped */
+  RESYNC_LIVE,     /* continue the timestamps where the old connection left off */
+};
 
 enum {
   AV_SYNC_AUDIO_MASTER,
@@ -223,16 +367,20 @@ enum {
 
 int private_main(int argc, char *argv[]);
 
+double get_audio_write_clock(VideoState *is);
+
+int clock_snapshot_read(ClockSnapshot *clock, double *pts);
+
 VideoState *create();
 VideoState *getNextMediaPlayer(VideoState **ps);
 void disconnect(VideoState **ps);
 int setDataSourceURI(VideoState **ps, const char *url, const char *headers);
 int setDataSourceFD(VideoState **ps, int fd, int64_t offset, int64_t length);
 int setVideoSurface(VideoState **ps, void* native_window);
-int setListener(VideoState **ps,  void* clazz, void (*listener) (void*, int, int, int, int));
+int setListener(VideoState **ps,  void* clazz, void (*listener) (void*, int, int, int, int, AVDictionary*));
 int setMetadataFilter(VideoState **ps, char *allow[], char *block[]);
 int getMetadata(VideoState **ps, AVDictionary **metadata);
-int prepare(VideoState **ps);
+int prepare(VideoState **ps, int timeout_ms);
 int prepareAsync(VideoState **ps);
 int start(VideoState **ps);
 int stop(VideoState **ps);
@@ -248,9 +396,22 @@ int setAudioStreamType(VideoState **ps, int type);
 int setLooping(VideoState **ps, int loop);
 int isLooping(VideoState **ps);
 int setVolume(VideoState **ps, float leftVolume, float rightVolume);
+int setPlaybackSpeed(VideoState **ps, float speed);
+int setLoudnessNormalization(VideoState **ps, int mode);
+int setCrossfadeDuration(VideoState **ps, int msec);
+int setPreroll(VideoState **ps, int msec);
+int setLiveLatency(VideoState **ps, int msec);
+int setReadAheadSize(VideoState **ps, int bytes);
+int setProbeCacheDirectory(const char *path);
+int setHttpCacheDirectory(const char *path, int64_t max_size);
+int probeMetadata(const char *url, AVDictionary **metadata);
+int setOption(VideoState **ps, const char *key, const char *value);
+int setClockSnapshot(VideoState **ps, ClockSnapshot *clock);
 void notify(VideoState *is, int msg, int ext1, int ext2);
 void notify_from_thread(VideoState *is, int msg, int ext1, int ext2);
+void notify_metadata_from_thread(VideoState *is, AVDictionary *changed);
 int setNextPlayer(VideoState **ps, VideoState *next);
+int startAsNext(VideoState **ps);
 
 void clear_l(VideoState **ps);
 int seekTo_l(VideoState **ps, int msec);
@@ -20,20 +20,74 @@
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libswscale/swscale.h>
+#include <libavutil/avstring.h>
 #include <libavutil/opt.h>
+#include <libavutil/replaygain.h>
 #include <ffmpeg_utils.h>
 
 #include <stdio.h>
+#include <string.h>
 
-void set_shoutcast_metadata(AVFormatContext *ic) {
+/*
+ * Returns the last ICY metadata packet read by the http context under obj,
+ * NULL if there is none. The caller frees it with av_free.
+ */
+char *get_shoutcast_metadata(void *obj) {
     char *value = NULL;
-    
-    if (av_opt_get(ic, "icy_metadata_packet", 1, (uint8_t **) &value) < 0) {
-        value = NULL;
+
+    if (av_opt_get(obj, "icy_metadata_packet", AV_OPT_SEARCH_CHILDREN, (uint8_t **) &value) < 0) {
+        return NULL;
     }
-	
-    if (value && value[0]) {
-    	av_dict_set(&ic->metadata, ICY_METADATA, value, 0);
+
+    if (value && !value[0]) {
+        av_freep(&value);
+    }
+
+    return value;
+}
+
+/*
+ * Splits a packet like StreamTitle='Artist - Title';StreamUrl='...'; into
+ * the ICY_TITLE and ICY_URL keys. Values may contain quotes, only ';
+ * ends one.
+ */
+void parse_shoutcast_metadata(const char *packet, AVDictionary **metadata) {
+    const char *key, *value, *end, *next;
+    char *s;
+
+    while (packet && (value = strstr(packet, "='"))) {
+        key = NULL;
+        if (av_strstart(packet, "StreamTitle", NULL) && value - packet == 11) {
+            key = ICY_TITLE;
+        } else if (av_strstart(packet, "StreamUrl", NULL) && value - packet == 9) {
+            key = ICY_URL;
+        }
+
+        value += 2;
+        if ((end = strstr(value, "';"))) {
+            next = end + 2;
+        } else {
+            /* the last value may lack the ; */
+            end = value + strlen(value);
+            if (end > value && end[-1] == '\'') {
+                end--;
+            }
+            next = NULL;
+        }
+
+        if (key && (s = av_strndup(value, end - value))) {
+            av_dict_set(metadata, key, s, AV_DICT_DONT_STRDUP_VAL);
+        }
+
+        packet = next;
+    }
+}
+
+void set_shoutcast_metadata(AVFormatContext *ic) {
+    char *value = get_shoutcast_metadata(ic);
+
+    if (value) {
+    	av_dict_set(&ic->metadata, ICY_METADATA, value, AV_DICT_DONT_STRDUP_VAL);
     }
 }
 
@@ -131,6 +185,96 @@ void set_video_dimensions(AVFormatContext *ic, AVStream *video_st) {
 	}
 }
 
+/*
+ * Reads the iTunSMPB tag written by iTunes and most AAC/MP3 encoders,
+ * " 00000000 00000840 000001C0 0000000000A1B2C3", which holds the
+ * encoder delay, the end padding and the number of valid samples in hex.
+ */
+int get_gapless_info(AVFormatContext *ic, AVStream *audio_st, int64_t *priming, int64_t *valid_samples) {
+	AVDictionaryEntry *entry = NULL;
+	unsigned int delay = 0, padding = 0;
+	uint64_t samples = 0;
+
+	if (!ic || !audio_st) {
+		return FAILURE;
+	}
+
+	entry = av_dict_get(audio_st->metadata, ITUNSMPB, NULL, 0);
+	if (!entry) {
+		entry = av_dict_get(ic->metadata, ITUNSMPB, NULL, 0);
+	}
+
+	if (!entry || !entry->value) {
+		return FAILURE;
+	}
+
+	if (sscanf(entry->value, "%*x %x %x %" SCNx64, &delay, &padding, &samples) != 3 || samples == 0) {
+		return FAILURE;
+	}
+
+	*priming = delay;
+	*valid_samples = samples;
+
+	return SUCCESS;
+}
+
+static AVDictionaryEntry *get_audio_tag(AVFormatContext *ic, AVStream *audio_st, const char *key) {
+	AVDictionaryEntry *entry = av_dict_get(audio_st->metadata, key, NULL, 0);
+
+	if (!entry) {
+		entry = av_dict_get(ic->metadata, key, NULL, 0);
+	}
+
+	return entry && entry->value ? entry : NULL;
+}
+
+/* Finds the track (album == 0) or album gain in dB relative to the
+   ReplayGain reference level, and the linear peak or 0 if unknown. Uses
+   the side data exported by the demuxer, then the REPLAYGAIN_* and
+   R128_* tags */
+int get_replaygain_info(AVFormatContext *ic, AVStream *audio_st, int album, float *gain, float *peak) {
+	AVReplayGain *rg;
+	AVDictionaryEntry *entry;
+	int size = 0;
+	int q78;
+
+	if (!ic || !audio_st) {
+		return FAILURE;
+	}
+
+	rg = (AVReplayGain *) av_stream_get_side_data(audio_st, AV_PKT_DATA_REPLAYGAIN, &size);
+	if (rg && size >= sizeof(AVReplayGain)) {
+		int32_t rg_gain = album ? rg->album_gain : rg->track_gain;
+		uint32_t rg_peak = album ? rg->album_peak : rg->track_peak;
+
+		if (rg_gain != INT32_MIN) {
+			*gain = rg_gain / 100000.0f;
+			*peak = rg_peak / 100000.0f;
+			return SUCCESS;
+		}
+	}
+
+	entry = get_audio_tag(ic, audio_st, album ? REPLAYGAIN_ALBUM_GAIN : REPLAYGAIN_TRACK_GAIN);
+	if (entry && sscanf(entry->value, "%f", gain) == 1) {
+		*peak = 0;
+		entry = get_audio_tag(ic, audio_st, album ? REPLAYGAIN_ALBUM_PEAK : REPLAYGAIN_TRACK_PEAK);
+		if (entry && sscanf(entry->value, "%f", peak) != 1) {
+			*peak = 0;
+		}
+		return SUCCESS;
+	}
+
+	entry = get_audio_tag(ic, audio_st, album ? R128_ALBUM_GAIN : R128_TRACK_GAIN);
+	if (entry && sscanf(entry->value, "%d", &q78) == 1) {
+		/* Q7.8 dB relative to -23 LUFS, ReplayGain 2.0 references -18 LUFS */
+		*gain = q78 / 256.0f + 5.0f;
+		*peak = 0;
+		return SUCCESS;
+	}
+
+	return FAILURE;
+}
+
 const char* extract_metadata_internal(AVFormatContext *ic, AVStream *audio_st, AVStream *video_st, const char* key) {
     char* value = NULL;
     
@@ -29,6 +29,8 @@ static const char *DURATION = "duration";
 static const char *AUDIO_CODEC = "audio_codec";
 static const char *VIDEO_CODEC = "video_codec";
 static const char *ICY_METADATA = "icy_metadata";
+static const char *ICY_TITLE = "icy_title";
+static const char *ICY_URL = "icy_url";
 static const char *ROTATE = "rotate";
 static const char *FRAMERATE = "framerate";
 static const char *CHAPTER_START_TIME = "chapter_start_time";
@@ -37,10 +39,19 @@ static const char *CHAPTER_COUNT = "chapter_count";
 static const char *FILESIZE = "filesize";
 static const char *VIDEO_WIDTH = "video_width";
 static const char *VIDEO_HEIGHT = "video_height";
+static const char *ITUNSMPB = "iTunSMPB";
+static const char *REPLAYGAIN_TRACK_GAIN = "REPLAYGAIN_TRACK_GAIN";
+static const char *REPLAYGAIN_TRACK_PEAK = "REPLAYGAIN_TRACK_PEAK";
+static const char *REPLAYGAIN_ALBUM_GAIN = "REPLAYGAIN_ALBUM_GAIN";
+static const char *REPLAYGAIN_ALBUM_PEAK = "REPLAYGAIN_ALBUM_PEAK";
+static const char *R128_TRACK_GAIN = "R128_TRACK_GAIN";
+static const char *R128_ALBUM_GAIN = "R128_ALBUM_GAIN";
 
 static const int SUCCESS = 0;
 static const int FAILURE = -1;
 
+char *get_shoutcast_metadata(void *obj);
+void parse_shoutcast_metadata(const char *packet, AVDictionary **metadata);
 void set_shoutcast_metadata(AVFormatContext *ic);
 void set_duration(AVFormatContext *ic);
 void set_codec(AVFormatContext *ic, int i);
@@ -49,6 +60,8 @@ void set_framerate(AVFormatContext *ic, AVStream *audio_st, AVStream *video_st);
 void set_filesize(AVFormatContext *ic);
 void set_chapter_count(AVFormatContext *ic);
 void set_video_dimensions(AVFormatContext *ic, AVStream *video_st);
+int get_gapless_info(AVFormatContext *ic, AVStream *audio_st, int64_t *priming, int64_t *valid_samples);
+int get_replaygain_info(AVFormatContext *ic, AVStream *audio_st, int album, float *gain, float *peak);
 const char* extract_metadata_internal(AVFormatContext *ic, AVStream *audio_st, AVStream *video_st, const char* key);
 int get_metadata_internal(AVFormatContext *ic, AVDictionary **metadata);
 const char* extract_metadata_from_chapter_internal(AVFormatContext *ic, AVStream *audio_st, AVStream *video_st, const char* key, int chapter);    
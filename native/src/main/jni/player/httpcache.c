@@ -0,0 +1,527 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <libavutil/avstring.h>
+
+#include <httpcache.h>
+
+#define HTTPCACHE_MAGIC 0x43484d46   /* "FMHC" */
+#define HTTPCACHE_VERSION 1
+#define HTTPCACHE_MAX_RANGES 65536
+
+typedef struct HttpCacheRange {
+	int64_t start;
+	int64_t end;
+} HttpCacheRange;
+
+typedef struct HttpCacheIndex {
+	uint32_t magic;
+	uint32_t version;
+	int64_t size;
+	int32_t nb_ranges;
+	int32_t url_size;
+} HttpCacheIndex;
+
+typedef struct HttpCache {
+	char *url;
+	AVDictionary *options;
+	AVIOInterruptCB int_cb;
+	AVIOContext *net;        /* opened on the first miss */
+	int64_t net_pos;
+	int data_fd;
+	char data_path[PATH_MAX];
+	char index_path[PATH_MAX];
+	int64_t size;
+	int64_t pos;
+	HttpCacheRange *ranges;  /* sorted, disjoint and not adjacent */
+	int nb_ranges;
+	int64_t unsaved;         /* bytes downloaded since the index was written */
+} HttpCache;
+
+typedef struct HttpCacheEntry {
+	char name[32];
+	time_t used;
+	int64_t size;
+} HttpCacheEntry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char directory[PATH_MAX];
+static int64_t max_cache_size;
+
+int httpcache_set_directory(const char *path, int64_t max_size) {
+	int ret = 0;
+
+	pthread_mutex_lock(&cache_lock);
+	if (!path || !*path) {
+		directory[0] = '\0';
+	} else if (strlen(path) >= sizeof(directory) - 32 || max_size <= 0) {
+		ret = -1;
+	} else if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+		ret = -1;
+	} else {
+		strcpy(directory, path);
+		max_cache_size = max_size;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return ret;
+}
+
+int httpcache_enabled() {
+	int enabled;
+
+	pthread_mutex_lock(&cache_lock);
+	enabled = directory[0] != '\0';
+	pthread_mutex_unlock(&cache_lock);
+
+	return enabled;
+}
+
+/* 64 bit FNV-1a of the url names the cache files */
+static uint64_t hash_url(const char *url) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*url) {
+		hash ^= (uint8_t) *url++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static int add_range(HttpCache *c, int64_t start, int64_t end) {
+	HttpCacheRange *r;
+	int i, j;
+
+	if (c->nb_ranges >= HTTPCACHE_MAX_RANGES) {
+		return -1;
+	}
+
+	r = av_realloc_array(c->ranges, c->nb_ranges + 1, sizeof(*r));
+	if (!r) {
+		return -1;
+	}
+	c->ranges = r;
+
+	for (i = c->nb_ranges; i > 0 && r[i - 1].start > start; i--) {
+		r[i] = r[i - 1];
+	}
+	r[i].start = start;
+	r[i].end = end;
+	c->nb_ranges++;
+
+	// merge what now overlaps or touches
+	for (i = 0, j = 1; j < c->nb_ranges; j++) {
+		if (r[j].start <= r[i].end) {
+			if (r[j].end > r[i].end) {
+				r[i].end = r[j].end;
+			}
+		} else {
+			r[++i] = r[j];
+		}
+	}
+	c->nb_ranges = i + 1;
+
+	return 0;
+}
+
+static int load_index(HttpCache *c) {
+	HttpCacheIndex h;
+	struct stat st;
+	char *url = NULL;
+	FILE *f;
+	int ret = -1;
+
+	if (!(f = fopen(c->index_path, "rb"))) {
+		return -1;
+	}
+
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+			h.magic != HTTPCACHE_MAGIC || h.version != HTTPCACHE_VERSION ||
+			h.size <= 0 || h.nb_ranges < 0 || h.nb_ranges > HTTPCACHE_MAX_RANGES ||
+			h.url_size != strlen(c->url)) {
+		goto end;
+	}
+
+	url = av_malloc(h.url_size + 1);
+	if (!url || fread(url, h.url_size, 1, f) != 1) {
+		goto end;
+	}
+	url[h.url_size] = '\0';
+	if (strcmp(url, c->url)) {
+		// another url with the same hash
+		goto end;
+	}
+
+	c->ranges = av_malloc_array(h.nb_ranges ? h.nb_ranges : 1, sizeof(*c->ranges));
+	if (!c->ranges || (h.nb_ranges && fread(c->ranges, sizeof(*c->ranges), h.nb_ranges, f) != h.nb_ranges)) {
+		av_freep(&c->ranges);
+		goto end;
+	}
+	c->nb_ranges = h.nb_ranges;
+	c->size = h.size;
+
+	// the data file may have been evicted while this entry was in use
+	if (c->nb_ranges &&
+			(stat(c->data_path, &st) != 0 || st.st_size < c->ranges[c->nb_ranges - 1].end)) {
+		c->nb_ranges = 0;
+	}
+	ret = 0;
+
+end:
+	av_free(url);
+	fclose(f);
+	return ret;
+}
+
+static void save_index(HttpCache *c) {
+	char tmp[PATH_MAX];
+	HttpCacheIndex h;
+	FILE *f;
+	int ok;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", c->index_path);
+	if (!(f = fopen(tmp, "wb"))) {
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.magic = HTTPCACHE_MAGIC;
+	h.version = HTTPCACHE_VERSION;
+	h.size = c->size;
+	h.nb_ranges = c->nb_ranges;
+	h.url_size = strlen(c->url);
+
+	ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+			fwrite(c->url, h.url_size, 1, f) == 1 &&
+			(!c->nb_ranges || fwrite(c->ranges, sizeof(*c->ranges), c->nb_ranges, f) == c->nb_ranges);
+
+	if (fclose(f) != 0 || !ok || rename(tmp, c->index_path) != 0) {
+		unlink(tmp);
+		return;
+	}
+	c->unsaved = 0;
+}
+
+static int open_net(HttpCache *c) {
+	AVDictionary *options = NULL;
+	int64_t size;
+	int ret;
+
+	av_dict_copy(&options, c->options, 0);
+	ret = avio_open2(&c->net, c->url, AVIO_FLAG_READ, &c->int_cb, &options);
+	av_dict_free(&options);
+	if (ret < 0) {
+		return ret;
+	}
+	c->net_pos = 0;
+
+	size = avio_size(c->net);
+	if (size <= 0) {
+		avio_closep(&c->net);
+		return AVERROR(EIO);
+	}
+
+	if (c->size && size != c->size) {
+		// the resource changed since it was cached
+		c->nb_ranges = 0;
+		if (ftruncate(c->data_fd, 0) != 0) {
+			avio_closep(&c->net);
+			return AVERROR(errno);
+		}
+		c->unsaved = 1;
+	}
+	c->size = size;
+
+	return 0;
+}
+
+static int httpcache_read(void *opaque, uint8_t *buf, int buf_size) {
+	HttpCache *c = opaque;
+	ssize_t n;
+	int i;
+	int ret;
+
+	if (c->pos >= c->size) {
+		return AVERROR_EOF;
+	}
+	if (buf_size > c->size - c->pos) {
+		buf_size = c->size - c->pos;
+	}
+
+	for (i = 0; i < c->nb_ranges && c->ranges[i].end <= c->pos; i++) {
+	}
+
+	if (i < c->nb_ranges && c->ranges[i].start <= c->pos) {
+		if (buf_size > c->ranges[i].end - c->pos) {
+			buf_size = c->ranges[i].end - c->pos;
+		}
+		do {
+			n = pread(c->data_fd, buf, buf_size, c->pos);
+		} while (n < 0 && errno == EINTR);
+
+		if (n > 0) {
+			c->pos += n;
+			return n;
+		}
+		// the data is gone, download it again
+	} else if (i < c->nb_ranges && buf_size > c->ranges[i].start - c->pos) {
+		// stop where the cached data starts
+		buf_size = c->ranges[i].start - c->pos;
+	}
+
+	if (!c->net && (ret = open_net(c)) < 0) {
+		return ret;
+	}
+	if (c->net_pos != c->pos) {
+		if ((ret = avio_seek(c->net, c->pos, SEEK_SET)) < 0) {
+			return ret;
+		}
+		c->net_pos = c->pos;
+	}
+
+	ret = avio_read_partial(c->net, buf, buf_size);
+	if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_EXIT) {
+		// the connection dropped, the next read reconnects at c->pos
+		avio_closep(&c->net);
+	}
+	if (ret <= 0) {
+		return ret ? ret : AVERROR_EOF;
+	}
+
+	if (pwrite(c->data_fd, buf, ret, c->pos) == ret && add_range(c, c->pos, c->pos + ret) == 0) {
+		c->unsaved += ret;
+		if (c->unsaved >= HTTPCACHE_INDEX_FLUSH) {
+			save_index(c);
+		}
+	}
+
+	c->pos += ret;
+	c->net_pos += ret;
+	return ret;
+}
+
+static int64_t httpcache_seek(void *opaque, int64_t offset, int whence) {
+	HttpCache *c = opaque;
+	int64_t pos;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return c->size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = c->pos + offset;
+		break;
+	case SEEK_END:
+		pos = c->size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (pos < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	c->pos = pos;
+	return pos;
+}
+
+static void free_cache(HttpCache *c) {
+	if (c->data_fd >= 0) {
+		close(c->data_fd);
+	}
+	avio_closep(&c->net);
+	av_dict_free(&c->options);
+	av_free(c->ranges);
+	av_free(c->url);
+	av_free(c);
+}
+
+static int compare_entries(const void *a, const void *b) {
+	const HttpCacheEntry *ea = a;
+	const HttpCacheEntry *eb = b;
+
+	return ea->used < eb->used ? -1 : ea->used > eb->used;
+}
+
+/* Deletes the least recently used urls until the cache fits its budget */
+static void evict() {
+	HttpCacheEntry *entries = NULL;
+	HttpCacheEntry *grown;
+	char path[PATH_MAX];
+	struct dirent *d;
+	struct stat st;
+	int64_t total = 0;
+	int nb_entries = 0;
+	size_t len;
+	DIR *dir;
+	int i;
+
+	pthread_mutex_lock(&cache_lock);
+
+	if (!directory[0] || !(dir = opendir(directory))) {
+		pthread_mutex_unlock(&cache_lock);
+		return;
+	}
+
+	while ((d = readdir(dir))) {
+		len = strlen(d->d_name);
+		if (len != 22 || strcmp(d->d_name + 16, ".index")) {
+			continue;
+		}
+
+		grown = av_realloc_array(entries, nb_entries + 1, sizeof(*entries));
+		if (!grown) {
+			break;
+		}
+		entries = grown;
+
+		memcpy(entries[nb_entries].name, d->d_name, 16);
+		entries[nb_entries].name[16] = '\0';
+
+		snprintf(path, sizeof(path), "%s/%s", directory, d->d_name);
+		entries[nb_entries].used = stat(path, &st) == 0 ? st.st_mtime : 0;
+
+		snprintf(path, sizeof(path), "%s/%s.data", directory, entries[nb_entries].name);
+		// blocks actually allocated, the data files are sparse
+		entries[nb_entries].size = stat(path, &st) == 0 ? (int64_t) st.st_blocks * 512 : 0;
+
+		total += entries[nb_entries].size;
+		nb_entries++;
+	}
+	closedir(dir);
+
+	qsort(entries, nb_entries, sizeof(*entries), compare_entries);
+
+	for (i = 0; i < nb_entries && total > max_cache_size; i++) {
+		snprintf(path, sizeof(path), "%s/%s.index", directory, entries[i].name);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%s.data", directory, entries[i].name);
+		unlink(path);
+		total -= entries[i].size;
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+
+	av_free(entries);
+}
+
+AVIOContext *httpcache_open(const char *url, AVDictionary *options, const AVIOInterruptCB *int_cb) {
+	AVIOContext *pb = NULL;
+	uint8_t *buffer = NULL;
+	HttpCache *c;
+	uint64_t key;
+	int have_index;
+
+	if (!url || (!av_strstart(url, "http://", NULL) && !av_strstart(url, "https://", NULL))) {
+		return NULL;
+	}
+
+	c = av_mallocz(sizeof(HttpCache));
+	if (!c) {
+		return NULL;
+	}
+	c->data_fd = -1;
+	c->url = av_strdup(url);
+	if (!c->url || av_dict_copy(&c->options, options, 0) < 0) {
+		free_cache(c);
+		return NULL;
+	}
+	if (int_cb) {
+		c->int_cb = *int_cb;
+	}
+
+	key = hash_url(url);
+	pthread_mutex_lock(&cache_lock);
+	if (directory[0]) {
+		snprintf(c->data_path, sizeof(c->data_path), "%s/%016llx.data", directory, (unsigned long long) key);
+		snprintf(c->index_path, sizeof(c->index_path), "%s/%016llx.index", directory, (unsigned long long) key);
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	if (!c->data_path[0]) {
+		free_cache(c);
+		return NULL;
+	}
+
+	have_index = load_index(c) == 0;
+
+	c->data_fd = open(c->data_path, O_RDWR | O_CREAT, 0600);
+	if (c->data_fd < 0 || (!have_index && ftruncate(c->data_fd, 0) != 0)) {
+		free_cache(c);
+		return NULL;
+	}
+
+	// without an index the length is only known once connected, live streams have none
+	if (!have_index && open_net(c) < 0) {
+		free_cache(c);
+		return NULL;
+	}
+
+	// most recently used
+	utimes(c->index_path, NULL);
+
+	buffer = av_malloc(HTTPCACHE_BUFFER_SIZE);
+	if (buffer) {
+		pb = avio_alloc_context(buffer, HTTPCACHE_BUFFER_SIZE, 0, c, httpcache_read, NULL, httpcache_seek);
+	}
+	if (!pb) {
+		av_free(buffer);
+		free_cache(c);
+		return NULL;
+	}
+	pb->seekable = AVIO_SEEKABLE_NORMAL;
+
+	return pb;
+}
+
+void httpcache_close(AVIOContext **pb) {
+	HttpCache *c;
+
+	if (!pb || !*pb) {
+		return;
+	}
+
+	c = (*pb)->opaque;
+	if (c) {
+		if (c->unsaved) {
+			save_index(c);
+		}
+		free_cache(c);
+	}
+
+	av_freep(&(*pb)->buffer);
+	avio_context_free(pb);
+
+	evict();
+}
@@ -0,0 +1,49 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HTTPCACHE_H_
+#define HTTPCACHE_H_
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+#define HTTPCACHE_BUFFER_SIZE 32768
+#define HTTPCACHE_INDEX_FLUSH (4 * 1024 * 1024)  /* downloaded bytes between index writes */
+
+/*
+ * Persistent progressive download cache for http and https sources.
+ * Each url is kept as a sparse data file plus an index of the byte
+ * ranges downloaded so far. Reads are served from the data file where
+ * possible and from the network otherwise, and whatever comes from the
+ * network is added to the cache. The cache as a whole is kept under a
+ * size budget by evicting the least recently used urls.
+ */
+
+/* NULL or "" disables the cache */
+int httpcache_set_directory(const char *path, int64_t max_size);
+int httpcache_enabled();
+
+/*
+ * Returns a seekable AVIOContext over url, or NULL if the url is not
+ * cacheable, for instance a live stream without a known length. options
+ * are used for the http requests.
+ */
+AVIOContext *httpcache_open(const char *url, AVDictionary *options, const AVIOInterruptCB *int_cb);
+void httpcache_close(AVIOContext **pb);
+
+#endif /*HTTPCACHE_H_*/
@@ -0,0 +1,249 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <loudness.h>
+
+#define ABSOLUTE_GATE (-70.0)
+#define RELATIVE_GATE (-10.0)
+#define HISTOGRAM_MIN ABSOLUTE_GATE
+#define HISTOGRAM_STEP 0.1
+
+static double block_loudness(double energy) {
+	return -0.691 + 10.0 * log10(energy);
+}
+
+static double bin_energy(int bin) {
+	double lufs = HISTOGRAM_MIN + (bin + 0.5) * HISTOGRAM_STEP;
+
+	return pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+/* Coefficients of the two K-weighting biquads for the sample rate,
+   as given for 48 kHz in BS.1770 and rederived for other rates */
+static void init_filters(Loudness *l) {
+	double f0, g, q, k, vh, vb, a0;
+
+	f0 = 1681.974450955533;
+	g = 3.999843853973347;
+	q = 0.7071752369554196;
+	k = tan(M_PI * f0 / l->sample_rate);
+	vh = pow(10.0, g / 20.0);
+	vb = pow(vh, 0.4996667741545416);
+	a0 = 1.0 + k / q + k * k;
+
+	l->pre_b[0] = (float) ((vh + vb * k / q + k * k) / a0);
+	l->pre_b[1] = (float) (2.0 * (k * k - vh) / a0);
+	l->pre_b[2] = (float) ((vh - vb * k / q + k * k) / a0);
+	l->pre_a[0] = 1.0f;
+	l->pre_a[1] = (float) (2.0 * (k * k - 1.0) / a0);
+	l->pre_a[2] = (float) ((1.0 - k / q + k * k) / a0);
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / l->sample_rate);
+	a0 = 1.0 + k / q + k * k;
+
+	l->rlb_b[0] = 1.0f;
+	l->rlb_b[1] = -2.0f;
+	l->rlb_b[2] = 1.0f;
+	l->rlb_a[0] = 1.0f;
+	l->rlb_a[1] = (float) (2.0 * (k * k - 1.0) / a0);
+	l->rlb_a[2] = (float) ((1.0 - k / q + k * k) / a0);
+}
+
+static void init_weights(Loudness *l) {
+	int c;
+
+	for (c = 0; c < LOUDNESS_MAX_CHANNELS; c++) {
+		l->weight[c] = 1.0f;
+	}
+
+	if (l->channels == 5) {
+		/* L R C Ls Rs */
+		l->weight[3] = l->weight[4] = 1.41f;
+	} else if (l->channels >= 6) {
+		/* L R C LFE Ls Rs, the LFE is not measured */
+		l->weight[3] = 0.0f;
+		l->weight[4] = l->weight[5] = 1.41f;
+	}
+}
+
+Loudness *loudness_create(int channels, int sample_rate) {
+	Loudness *l;
+
+	if (channels <= 0 || channels > LOUDNESS_MAX_CHANNELS || sample_rate <= 0) {
+		return NULL;
+	}
+
+	l = calloc(1, sizeof(Loudness));
+	if (!l) {
+		return NULL;
+	}
+
+	l->channels = channels;
+	l->sample_rate = sample_rate;
+	l->step_frames = sample_rate / 10;
+	if (l->step_frames < 1) {
+		l->step_frames = 1;
+	}
+
+	init_filters(l);
+	init_weights(l);
+
+	return l;
+}
+
+/* Closes the current 100 ms step and gates the 400 ms block ending on it */
+static int finish_step(Loudness *l) {
+	double energy;
+	int bin;
+
+	l->steps[0] = l->steps[1];
+	l->steps[1] = l->steps[2];
+	l->steps[2] = l->steps[3];
+	l->steps[3] = l->step_sum / l->step_frames;
+	l->step_sum = 0;
+	l->step_pos = 0;
+
+	if (l->steps_filled < 4) {
+		l->steps_filled++;
+		if (l->steps_filled < 4) {
+			return 0;
+		}
+	}
+
+	energy = (l->steps[0] + l->steps[1] + l->steps[2] + l->steps[3]) / 4.0;
+	if (energy <= 0.0 || block_loudness(energy) <= ABSOLUTE_GATE) {
+		return 0;
+	}
+
+	bin = (int) ((block_loudness(energy) - HISTOGRAM_MIN) / HISTOGRAM_STEP);
+	if (bin >= LOUDNESS_HISTOGRAM_BINS) {
+		bin = LOUDNESS_HISTOGRAM_BINS - 1;
+	}
+
+	l->histogram[bin]++;
+	l->blocks++;
+
+	return 1;
+}
+
+/*
+ * Runs the samples through the K-weighting filters and accumulates the
+ * mean square per step, return the number of new blocks that passed the
+ * absolute gate. The filters are transposed direct form II in single
+ * precision. They are recursive, each output feeds the next sample, so
+ * the samples are filtered one frame at a time.
+ */
+int loudness_process(Loudness *l, const int16_t *samples, int frames) {
+	const float scale = 1.0f / 32768.0f;
+	int blocks = 0;
+	int i, c;
+
+	if (!l || !samples) {
+		return 0;
+	}
+
+	for (i = 0; i < frames; i++) {
+		float sum = 0.0f;
+
+		for (c = 0; c < l->channels; c++) {
+			float *s = l->state[c];
+			float x = samples[c] * scale;
+			float y = l->pre_b[0] * x + s[0];
+
+			s[0] = l->pre_b[1] * x - l->pre_a[1] * y + s[1];
+			s[1] = l->pre_b[2] * x - l->pre_a[2] * y;
+
+			x = y;
+			y = l->rlb_b[0] * x + s[2];
+			s[2] = l->rlb_b[1] * x - l->rlb_a[1] * y + s[3];
+			s[3] = l->rlb_b[2] * x - l->rlb_a[2] * y;
+
+			sum += l->weight[c] * y * y;
+		}
+
+		samples += l->channels;
+		l->step_sum += sum;
+
+		if (++l->step_pos >= l->step_frames) {
+			blocks += finish_step(l);
+		}
+	}
+
+	return blocks;
+}
+
+/* Gated integrated loudness of everything processed so far, returns -1
+   until at least min_blocks blocks were measured */
+int loudness_integrated(Loudness *l, int min_blocks, double *lufs) {
+	double sum = 0.0, gate;
+	uint32_t count = 0;
+	int bin;
+
+	if (!l || l->blocks == 0 || l->blocks < (uint32_t) min_blocks) {
+		return -1;
+	}
+
+	for (bin = 0; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+		sum += l->histogram[bin] * bin_energy(bin);
+	}
+
+	gate = block_loudness(sum / l->blocks) + RELATIVE_GATE;
+
+	sum = 0.0;
+	for (bin = 0; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+		if (HISTOGRAM_MIN + (bin + 0.5) * HISTOGRAM_STEP > gate) {
+			sum += l->histogram[bin] * bin_energy(bin);
+			count += l->histogram[bin];
+		}
+	}
+
+	if (count == 0) {
+		return -1;
+	}
+
+	*lufs = block_loudness(sum / count);
+
+	return 0;
+}
+
+void loudness_reset(Loudness *l) {
+	if (!l) {
+		return;
+	}
+
+	memset(l->state, 0, sizeof(l->state));
+	memset(l->steps, 0, sizeof(l->steps));
+	memset(l->histogram, 0, sizeof(l->histogram));
+	l->step_pos = 0;
+	l->step_sum = 0;
+	l->steps_filled = 0;
+	l->blocks = 0;
+}
+
+void loudness_free(Loudness **l) {
+	if (l && *l) {
+		free(*l);
+		*l = NULL;
+	}
+}
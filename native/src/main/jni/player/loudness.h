@@ -0,0 +1,57 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOUDNESS_H_
+#define LOUDNESS_H_
+
+#include <stdint.h>
+
+#define LOUDNESS_MAX_CHANNELS 8
+#define LOUDNESS_HISTOGRAM_BINS 800  /* 0.1 LU bins from -70 to +10 LUFS */
+
+/*
+ * Streaming EBU R128 / ITU-R BS.1770 integrated loudness meter for
+ * interleaved S16 PCM. Blocks of 400 ms overlapping by 75% are gated into
+ * a histogram, so memory use doesn't grow with the length of the input.
+ */
+typedef struct Loudness {
+	int channels;
+	int sample_rate;
+
+	float weight[LOUDNESS_MAX_CHANNELS];  /* channel weights, 0 for the LFE */
+	float pre_b[3], pre_a[3];             /* K-weighting shelving filter */
+	float rlb_b[3], rlb_a[3];             /* K-weighting high pass filter */
+	float state[LOUDNESS_MAX_CHANNELS][4];
+
+	int step_frames;                      /* frames in a 100 ms step */
+	int step_pos;
+	double step_sum;                      /* weighted sum of squares of the current step */
+	double steps[4];                      /* the last four steps make up a block */
+	int steps_filled;
+
+	uint32_t histogram[LOUDNESS_HISTOGRAM_BINS];
+	uint32_t blocks;                      /* blocks above the absolute gate */
+} Loudness;
+
+Loudness *loudness_create(int channels, int sample_rate);
+int loudness_process(Loudness *l, const int16_t *samples, int frames);
+int loudness_integrated(Loudness *l, int min_blocks, double *lufs);
+void loudness_reset(Loudness *l);
+void loudness_free(Loudness **l);
+
+#endif /*LOUDNESS_H_*/
@@ -51,6 +51,14 @@ MediaPlayer::MediaPlayer()
     mPrepareStatus = NO_ERROR;
     mLoop = false;
     mLeftVolume = mRightVolume = 1.0;
+    mPlaybackSpeed = 1.0;
+    mLoudnessMode = LOUDNESS_NORMALIZATION_OFF;
+    mCrossfadeDuration = 0;
+    mPreroll = DEFAULT_PREROLL_MS;
+    mLiveLatency = 0;
+    mReadAheadSize = DEFAULT_READAHEAD_SIZE;
+    mOptions = NULL;
+    memset(&mClock, 0, sizeof(mClock));
     mVideoWidth = mVideoHeight = 0;
     //mLockThreadId = 0;
     mAudioSessionId = 0;
@@ -61,6 +69,7 @@ MediaPlayer::~MediaPlayer()
 {
 	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "destructor");
     disconnect();
+    av_dict_free(&mOptions);
     //IPCThreadState::self()->flushCommands();
 }
 
@@ -89,10 +98,10 @@ void MediaPlayer::clear_l()
 }
 
 static void
-notifyListener(void* clazz, int msg, int ext1, int ext2, int fromThread)
+notifyListener(void* clazz, int msg, int ext1, int ext2, int fromThread, AVDictionary *obj)
 {
     MediaPlayer* mp = (MediaPlayer*) clazz;
-    mp->notify(msg, ext1, ext2, fromThread);
+    mp->notify(msg, ext1, ext2, fromThread, obj);
 }
 
 status_t MediaPlayer::setListener(MediaPlayerListener *listener)
@@ -126,6 +135,21 @@ status_t MediaPlayer::setDataSource(VideoState *player)
 
         ::clear_l(&player);
 	    ::setListener(&player, this, notifyListener);
+	    ::setLooping(&player, mLoop);
+	    ::setVolume(&player, mLeftVolume, mRightVolume);
+	    ::setPlaybackSpeed(&player, mPlaybackSpeed);
+	    ::setLoudnessNormalization(&player, mLoudnessMode);
+	    ::setCrossfadeDuration(&player, mCrossfadeDuration);
+	    ::setPreroll(&player, mPreroll);
+	    ::setLiveLatency(&player, mLiveLatency);
+	    ::setReadAheadSize(&player, mReadAheadSize);
+	    {
+	        AVDictionaryEntry *option = NULL;
+	        while ((option = av_dict_get(mOptions, "", option, AV_DICT_IGNORE_SUFFIX))) {
+	            ::setOption(&player, option->key, option->value);
+	        }
+	    }
+	    ::setClockSnapshot(&player, &mClock);
         clear_l();
         p = state;
         state = player;
@@ -225,7 +249,7 @@ status_t MediaPlayer::prepareAsync_l()
 // one defined in the Android framework and one provided by the implementation
 // that generated the error. The sync version of prepare returns only 1 error
 // code.
-status_t MediaPlayer::prepare()
+status_t MediaPlayer::prepare(int timeoutMs)
 {
 	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "prepare");
 	Mutex::Autolock _l(mLock);
@@ -234,17 +258,16 @@ status_t MediaPlayer::prepare()
 	//mLockThreadId = 0;
 	return -EALREADY;
 	}
-	mPrepareSync = true;
-	status_t ret = ::prepare(&state);
-	//status_t ret = prepareAsync_l();
-	if (ret != NO_ERROR) {
-	//mLockThreadId = 0;
-	return ret;
+	if ( (state == 0) || !( mCurrentState & ( MEDIA_PLAYER_INITIALIZED | MEDIA_PLAYER_STOPPED) ) ) {
+	return INVALID_OPERATION;
 	}
-	if (mPrepareSync) {
-	//mSignal.wait(mLock); // wait for prepare done
+	mPrepareSync = true;
+	mCurrentState = MEDIA_PLAYER_PREPARING;
+	// blocks until decode_thread has buffered enough, failed or timed out
+	mPrepareStatus = ::prepare(&state, timeoutMs);
 	mPrepareSync = false;
-	}
+	// the MEDIA_PREPARED event is delivered later by the event dispatcher
+	mCurrentState = (mPrepareStatus == NO_ERROR) ? MEDIA_PLAYER_PREPARED : MEDIA_PLAYER_STATE_ERROR;
 	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "prepare complete - status=%d", mPrepareStatus);
 	//mLockThreadId = 0;
 	return mPrepareStatus;
@@ -284,6 +307,20 @@ status_t MediaPlayer::start()
     return INVALID_OPERATION;
 }
 
+// called from notify once the previous player handed over to this one
+status_t MediaPlayer::startAsNext()
+{
+    Mutex::Autolock _l(mLock);
+    if ( (state != 0) && ( mCurrentState & ( MEDIA_PLAYER_PREPARED |
+                    MEDIA_PLAYER_PLAYBACK_COMPLETE | MEDIA_PLAYER_PAUSED ) ) ) {
+        status_t ret = ::startAsNext(&state);
+        mCurrentState = (ret == NO_ERROR) ? MEDIA_PLAYER_STARTED : MEDIA_PLAYER_STATE_ERROR;
+        return ret;
+    }
+    // already started, or stopped or reset since the handover
+    return INVALID_OPERATION;
+}
+
 status_t MediaPlayer::stop()
 {
 	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "stop");
@@ -362,19 +399,29 @@ status_t MediaPlayer::getVideoHeight(int *h)
     return NO_ERROR;
 }
 
+// Doesn't take mLock, UI code polls this while prepare, seekTo or reset
+// may be holding it. The position comes from mClock, which the player
+// threads publish to and which lives as long as this object.
 status_t MediaPlayer::getCurrentPosition(int *msec)
 {
 	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "getCurrentPosition");
-    Mutex::Autolock _l(mLock);
-    if (state != 0) {
-        if (mCurrentPosition >= 0) {
-        	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "Using cached seek position: %d", mCurrentPosition);
-            *msec = mCurrentPosition;
-            return NO_ERROR;
-        }
-        return ::getCurrentPosition(&state, msec);
+    double pts;
+    int position = __atomic_load_n(&mCurrentPosition, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&state, __ATOMIC_RELAXED) == 0) {
+        return INVALID_OPERATION;
     }
-    return INVALID_OPERATION;
+    if (position >= 0) {
+    	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "Using cached seek position: %d", position);
+        *msec = position;
+        return NO_ERROR;
+    }
+    if (clock_snapshot_read(&mClock, &pts) == 0) {
+        *msec = (int) (pts * 1000);
+    } else {
+        *msec = 0;
+    }
+    return NO_ERROR;
 }
 
 status_t MediaPlayer::getDuration_l(int *msec)
@@ -512,6 +559,110 @@ status_t MediaPlayer::setVolume(float leftVolume, float rightVolume)
     return OK;
 }
 
+status_t MediaPlayer::setPlaybackSpeed(float speed)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setPlaybackSpeed(%f)", speed);
+    Mutex::Autolock _l(mLock);
+    if (speed < MIN_PLAYBACK_SPEED || speed > MAX_PLAYBACK_SPEED) {
+        return BAD_VALUE;
+    }
+    mPlaybackSpeed = speed;
+    if (state != 0) {
+        return ::setPlaybackSpeed(&state, speed);
+    }
+    return OK;
+}
+
+status_t MediaPlayer::setLoudnessNormalization(int mode)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setLoudnessNormalization(%d)", mode);
+    Mutex::Autolock _l(mLock);
+    if (mode < LOUDNESS_NORMALIZATION_OFF || mode > LOUDNESS_NORMALIZATION_ALBUM) {
+        return BAD_VALUE;
+    }
+    mLoudnessMode = mode;
+    if (state != 0) {
+        return ::setLoudnessNormalization(&state, mode);
+    }
+    return OK;
+}
+
+status_t MediaPlayer::setCrossfadeDuration(int msec)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setCrossfadeDuration(%d)", msec);
+    Mutex::Autolock _l(mLock);
+    if (msec < 0 || msec > MAX_CROSSFADE_MS) {
+        return BAD_VALUE;
+    }
+    mCrossfadeDuration = msec;
+    if (state != 0) {
+        return ::setCrossfadeDuration(&state, msec);
+    }
+    return OK;
+}
+
+status_t MediaPlayer::setPreroll(int msec)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setPreroll(%d)", msec);
+    Mutex::Autolock _l(mLock);
+    if (msec < 0 || msec > MAX_PREROLL_MS) {
+        return BAD_VALUE;
+    }
+    mPreroll = msec;
+    if (state != 0) {
+        return ::setPreroll(&state, msec);
+    }
+    return OK;
+}
+
+status_t MediaPlayer::setLiveLatency(int msec)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setLiveLatency(%d)", msec);
+    Mutex::Autolock _l(mLock);
+    if (msec < 0 || msec > MAX_LIVE_LATENCY_MS) {
+        return BAD_VALUE;
+    }
+    mLiveLatency = msec;
+    if (state != 0) {
+        return ::setLiveLatency(&state, msec);
+    }
+    return OK;
+}
+
+status_t MediaPlayer::setReadAheadSize(int bytes)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setReadAheadSize(%d)", bytes);
+    Mutex::Autolock _l(mLock);
+    if (bytes < 0 || bytes > MAX_READAHEAD_SIZE) {
+        return BAD_VALUE;
+    }
+    mReadAheadSize = bytes;
+    if (state != 0) {
+        return ::setReadAheadSize(&state, bytes);
+    }
+    return OK;
+}
+
+status_t MediaPlayer::setOption(const char *key, const char *value)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setOption(%s, %s)", key, value);
+    Mutex::Autolock _l(mLock);
+    if (state != 0) {
+        status_t ret = ::setOption(&state, key, value);
+        if (ret != NO_ERROR) {
+            return ret;
+        }
+    } else if (!key || !*key ||
+            (!strcmp(key, "format") && value && !av_find_input_format(value))) {
+        return BAD_VALUE;
+    }
+    // kept for the players created by later calls to setDataSource
+    if (av_dict_set(&mOptions, key, value, 0) < 0) {
+        return NO_MEMORY;
+    }
+    return OK;
+}
+
 status_t MediaPlayer::setAudioSessionId(int sessionId)
 {
 	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setAudioSessionId(%d)", sessionId);
@@ -568,7 +719,7 @@ status_t MediaPlayer::attachAuxEffect(int effectId)
     }
 }
 
-void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread)
+void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread, const AVDictionary *obj)
 {
 	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "message received msg=%d, ext1=%d, ext2=%d", msg, ext1, ext2);
     bool send = true;
@@ -599,7 +750,10 @@ void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread)
         break;
     case MEDIA_PREPARED:
     	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "prepared");
-        mCurrentState = MEDIA_PLAYER_PREPARED;
+        // a synchronous prepare has already moved on, possibly to started
+        if (mCurrentState == MEDIA_PLAYER_PREPARING) {
+            mCurrentState = MEDIA_PLAYER_PREPARED;
+        }
         if (mPrepareSync) {
         	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "signal application thread");
             mPrepareSync = false;
@@ -635,6 +789,10 @@ void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread)
         // ext1: Media framework error code.
         // ext2: Implementation dependant error code.
     	//__android_log_print(ANDROID_LOG_WARN, LOG_TAG, "info/warning (%d, %d)", ext1, ext2);
+        if (ext1 == MEDIA_INFO_STARTED_AS_NEXT) {
+            // the previous player handed over to us, only report it once
+            send = (startAsNext() == NO_ERROR);
+        }
         break;
     case MEDIA_SEEK_COMPLETE:
     	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "Received seek complete");
@@ -668,12 +826,13 @@ void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread)
     if ((listener != 0) && send) {
         Mutex::Autolock _l(mNotifyLock);
         //__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "callback application");
-        listener->notify(msg, ext1, ext2, fromThread);
+        listener->notify(msg, ext1, ext2, fromThread, obj);
         //__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "back from callback");
     }
 }
 
 status_t MediaPlayer::setNextMediaPlayer(const MediaPlayer* next) {
+    Mutex::Autolock _l(mLock);
     if (state == NULL) {
         return NO_INIT;
     }
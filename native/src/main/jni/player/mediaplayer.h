@@ -57,7 +57,7 @@ enum media_player_states {
 class MediaPlayerListener
 {
 public:
-    virtual void notify(int msg, int ext1, int ext2, int fromThread) = 0;
+    virtual void notify(int msg, int ext1, int ext2, int fromThread, const AVDictionary *obj = NULL) = 0;
 };
 
 class MediaPlayer
@@ -74,7 +74,7 @@ public:
             status_t        setVideoSurface(void* native_window);
             status_t        setListener(MediaPlayerListener *listener);
             MediaPlayerListener * getListener();
-            status_t        prepare();
+            status_t        prepare(int timeoutMs = 0);
             status_t        prepareAsync();
             status_t        start();
             status_t        stop();
@@ -90,12 +90,20 @@ public:
             status_t        setLooping(int loop);
             bool            isLooping();
             status_t        setVolume(float leftVolume, float rightVolume);
-            void            notify(int msg, int ext1, int ext, int fromThread);
+            status_t        setPlaybackSpeed(float speed);
+            status_t        setLoudnessNormalization(int mode);
+            status_t        setCrossfadeDuration(int msec);
+            status_t        setPreroll(int msec);
+            status_t        setLiveLatency(int msec);
+            status_t        setReadAheadSize(int bytes);
+            status_t        setOption(const char *key, const char *value);
+            void            notify(int msg, int ext1, int ext, int fromThread, const AVDictionary *obj = NULL);
             status_t        setAudioSessionId(int sessionId);
             int             getAudioSessionId();
             status_t        setAuxEffectSendLevel(float level);
             int             attachAuxEffect(int effectId);
             status_t        setNextMediaPlayer(const MediaPlayer* player);
+            status_t        startAsNext();
 
     VideoState*                      state;
         
@@ -123,6 +131,14 @@ private:
     bool                        mLoop;
     float                       mLeftVolume;
     float                       mRightVolume;
+    float                       mPlaybackSpeed;
+    int                         mLoudnessMode;
+    int                         mCrossfadeDuration;
+    int                         mPreroll;
+    int                         mLiveLatency;
+    int                         mReadAheadSize;
+    AVDictionary*               mOptions;
+    ClockSnapshot               mClock;
     int                         mVideoWidth;
     int                         mVideoHeight;
     int                         mAudioSessionId;
@@ -0,0 +1,339 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <probecache.h>
+
+#define PROBE_CACHE_MAGIC 0x43504d46   /* "FMPC" */
+#define PROBE_CACHE_VERSION 1
+#define PROBE_CACHE_MAX_STREAMS 32
+#define PROBE_CACHE_MAX_EXTRADATA (1 << 20)
+
+typedef struct ProbeCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	int64_t duration;
+	int64_t start_time;
+	int64_t bit_rate;
+	uint32_t nb_streams;
+} ProbeCacheHeader;
+
+typedef struct ProbeCacheStream {
+	int32_t codec_type;
+	int32_t codec_id;
+	uint32_t codec_tag;
+	int32_t format;
+	int64_t bit_rate;
+	uint64_t channel_layout;
+	int32_t channels;
+	int32_t sample_rate;
+	int32_t frame_size;
+	int32_t width;
+	int32_t height;
+	AVRational sample_aspect_ratio;
+	AVRational avg_frame_rate;
+	AVRational r_frame_rate;
+	int64_t duration;
+	int64_t start_time;
+	int32_t extradata_size;
+} ProbeCacheStream;
+
+static pthread_mutex_t directory_lock = PTHREAD_MUTEX_INITIALIZER;
+static char directory[PATH_MAX];
+
+int probecache_set_directory(const char *path) {
+	int ret = 0;
+
+	pthread_mutex_lock(&directory_lock);
+	if (!path || !*path) {
+		directory[0] = '\0';
+	} else if (strlen(path) >= sizeof(directory) - 32) {
+		ret = -1;
+	} else if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+		ret = -1;
+	} else {
+		strcpy(directory, path);
+	}
+	pthread_mutex_unlock(&directory_lock);
+
+	return ret;
+}
+
+int probecache_enabled() {
+	int enabled;
+
+	pthread_mutex_lock(&directory_lock);
+	enabled = directory[0] != '\0';
+	pthread_mutex_unlock(&directory_lock);
+
+	return enabled;
+}
+
+/* 64 bit FNV-1a */
+static uint64_t hash_bytes(uint64_t hash, const void *data, int size) {
+	const uint8_t *p = data;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t probecache_key(const char *url, const uint8_t *head, int head_size, int64_t size) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	if (url) {
+		hash = hash_bytes(hash, url, strlen(url));
+	}
+	hash = hash_bytes(hash, &size, sizeof(size));
+	if (head && head_size > 0) {
+		hash = hash_bytes(hash, head, head_size);
+	}
+
+	return hash;
+}
+
+static int entry_path(uint64_t key, char *path, int size) {
+	int ret = -1;
+
+	pthread_mutex_lock(&directory_lock);
+	if (directory[0]) {
+		snprintf(path, size, "%s/%016llx.probe", directory, (unsigned long long) key);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&directory_lock);
+
+	return ret;
+}
+
+/* Whether the parameters are enough to open the decoder without probing */
+static int stream_complete(AVCodecParameters *par) {
+	if (par->codec_id == AV_CODEC_ID_NONE) {
+		return 0;
+	}
+
+	switch (par->codec_type) {
+	case AVMEDIA_TYPE_AUDIO:
+		return par->sample_rate > 0 && par->channels > 0;
+	case AVMEDIA_TYPE_VIDEO:
+		return par->width > 0 && par->height > 0;
+	default:
+		return 1;
+	}
+}
+
+static int apply_stream(FILE *f, AVStream *st) {
+	AVCodecParameters *par = st->codecpar;
+	ProbeCacheStream s;
+
+	if (fread(&s, sizeof(s), 1, f) != 1 ||
+			s.extradata_size < 0 || s.extradata_size > PROBE_CACHE_MAX_EXTRADATA) {
+		return -1;
+	}
+
+	if ((par->codec_type != AVMEDIA_TYPE_UNKNOWN && par->codec_type != s.codec_type) ||
+			(par->codec_id != AV_CODEC_ID_NONE && par->codec_id != s.codec_id)) {
+		// the content changed under the same key
+		return -1;
+	}
+
+	if (!par->extradata && s.extradata_size > 0) {
+		par->extradata = av_mallocz(s.extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+		if (!par->extradata) {
+			return -1;
+		}
+		if (fread(par->extradata, s.extradata_size, 1, f) != 1) {
+			av_freep(&par->extradata);
+			return -1;
+		}
+		par->extradata_size = s.extradata_size;
+	} else if (s.extradata_size > 0 && fseek(f, s.extradata_size, SEEK_CUR) != 0) {
+		return -1;
+	}
+
+	par->codec_type = s.codec_type;
+	par->codec_id = s.codec_id;
+	if (!par->codec_tag) {
+		par->codec_tag = s.codec_tag;
+	}
+	if (par->format < 0) {
+		par->format = s.format;
+	}
+	if (!par->bit_rate) {
+		par->bit_rate = s.bit_rate;
+	}
+	if (!par->channels) {
+		par->channels = s.channels;
+		par->channel_layout = s.channel_layout;
+	}
+	if (!par->sample_rate) {
+		par->sample_rate = s.sample_rate;
+	}
+	if (!par->frame_size) {
+		par->frame_size = s.frame_size;
+	}
+	if (!par->width || !par->height) {
+		par->width = s.width;
+		par->height = s.height;
+	}
+	if (!par->sample_aspect_ratio.num) {
+		par->sample_aspect_ratio = s.sample_aspect_ratio;
+	}
+	if (!st->avg_frame_rate.num) {
+		st->avg_frame_rate = s.avg_frame_rate;
+	}
+	if (!st->r_frame_rate.num) {
+		st->r_frame_rate = s.r_frame_rate;
+	}
+	if (st->duration == AV_NOPTS_VALUE) {
+		st->duration = s.duration;
+	}
+	if (st->start_time == AV_NOPTS_VALUE) {
+		st->start_time = s.start_time;
+	}
+
+	return 0;
+}
+
+int probecache_load(uint64_t key, AVFormatContext *ic) {
+	char path[PATH_MAX];
+	ProbeCacheHeader h;
+	FILE *f;
+	int complete = 1;
+	int i;
+
+	if (entry_path(key, path, sizeof(path)) < 0 || !(f = fopen(path, "rb"))) {
+		return -1;
+	}
+
+	if (fread(&h, sizeof(h), 1, f) != 1 ||
+			h.magic != PROBE_CACHE_MAGIC || h.version != PROBE_CACHE_VERSION ||
+			(ic->nb_streams && ic->nb_streams != h.nb_streams)) {
+		fclose(f);
+		return -1;
+	}
+
+	if (!ic->nb_streams) {
+		// the demuxer creates its streams while reading, only a probe finds them
+		fclose(f);
+		return 0;
+	}
+
+	for (i = 0; i < ic->nb_streams; i++) {
+		if (apply_stream(f, ic->streams[i]) < 0) {
+			fclose(f);
+			unlink(path);
+			return -1;
+		}
+		complete &= stream_complete(ic->streams[i]->codecpar);
+	}
+	fclose(f);
+
+	if (ic->duration == AV_NOPTS_VALUE) {
+		ic->duration = h.duration;
+	}
+	if (ic->start_time == AV_NOPTS_VALUE) {
+		ic->start_time = h.start_time;
+	}
+	if (!ic->bit_rate) {
+		ic->bit_rate = h.bit_rate;
+	}
+
+	if (!complete) {
+		return 0;
+	}
+
+	// find_stream_info would otherwise fill the decoder contexts
+	for (i = 0; i < ic->nb_streams; i++) {
+		avcodec_parameters_to_context(ic->streams[i]->codec, ic->streams[i]->codecpar);
+	}
+
+	return 1;
+}
+
+void probecache_store(uint64_t key, AVFormatContext *ic) {
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	ProbeCacheHeader h;
+	ProbeCacheStream s;
+	AVCodecParameters *par;
+	FILE *f;
+	int ok = 1;
+	int i;
+
+	if (!ic->nb_streams || ic->nb_streams > PROBE_CACHE_MAX_STREAMS ||
+			entry_path(key, path, sizeof(path)) < 0) {
+		return;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if (!(f = fopen(tmp, "wb"))) {
+		return;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.magic = PROBE_CACHE_MAGIC;
+	h.version = PROBE_CACHE_VERSION;
+	h.duration = ic->duration;
+	h.start_time = ic->start_time;
+	h.bit_rate = ic->bit_rate;
+	h.nb_streams = ic->nb_streams;
+	ok &= fwrite(&h, sizeof(h), 1, f) == 1;
+
+	for (i = 0; ok && i < ic->nb_streams; i++) {
+		par = ic->streams[i]->codecpar;
+
+		memset(&s, 0, sizeof(s));
+		s.codec_type = par->codec_type;
+		s.codec_id = par->codec_id;
+		s.codec_tag = par->codec_tag;
+		s.format = par->format;
+		s.bit_rate = par->bit_rate;
+		s.channel_layout = par->channel_layout;
+		s.channels = par->channels;
+		s.sample_rate = par->sample_rate;
+		s.frame_size = par->frame_size;
+		s.width = par->width;
+		s.height = par->height;
+		s.sample_aspect_ratio = par->sample_aspect_ratio;
+		s.avg_frame_rate = ic->streams[i]->avg_frame_rate;
+		s.r_frame_rate = ic->streams[i]->r_frame_rate;
+		s.duration = ic->streams[i]->duration;
+		s.start_time = ic->streams[i]->start_time;
+		s.extradata_size = par->extradata_size <= PROBE_CACHE_MAX_EXTRADATA ? par->extradata_size : 0;
+
+		ok &= fwrite(&s, sizeof(s), 1, f) == 1;
+		if (ok && s.extradata_size > 0) {
+			ok &= fwrite(par->extradata, s.extradata_size, 1, f) == 1;
+		}
+	}
+
+	if (fclose(f) != 0 || !ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+	}
+}
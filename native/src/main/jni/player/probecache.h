@@ -0,0 +1,50 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROBECACHE_H_
+#define PROBECACHE_H_
+
+#include <stdint.h>
+#include <libavformat/avformat.h>
+
+#define PROBE_SIGNATURE_SIZE 4096        /* leading bytes hashed into the key */
+#define PROBE_CACHE_PROBESIZE 32768      /* bounded probe on a partial hit */
+#define PROBE_CACHE_ANALYZE_DURATION 100000
+
+/*
+ * On-disk cache of the stream parameters avformat_find_stream_info works
+ * out, so that media opened again can skip or shorten the probe.
+ * Entries are keyed by a hash of the url and a signature of the content.
+ */
+
+/* Sets the directory entries are kept in, NULL or "" disables the cache */
+int probecache_set_directory(const char *path);
+int probecache_enabled();
+
+/* url may be NULL for content that has no stable name */
+uint64_t probecache_key(const char *url, const uint8_t *head, int head_size, int64_t size);
+
+/*
+ * Fills in what the demuxer left unset from the cached entry. Returns 1 if
+ * every stream is now fully described and find_stream_info can be skipped,
+ * 0 if the probe is still needed and -1 if there is no usable entry.
+ */
+int probecache_load(uint64_t key, AVFormatContext *ic);
+void probecache_store(uint64_t key, AVFormatContext *ic);
+
+#endif /*PROBECACHE_H_*/
@@ -0,0 +1,402 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/time.h>
+
+#include <readahead.h>
+
+#define READAHEAD_POLL_NS 50000000  /* how often a waiting reader checks for interrupts */
+
+typedef struct ReadAheadBlock {
+	uint8_t *data;
+	int size;
+} ReadAheadBlock;
+
+typedef struct ReadAhead {
+	AVIOContext *source;
+	AVIOInterruptCB int_cb;
+	int64_t size;
+
+	ReadAheadBlock *blocks;
+	int nb_blocks;
+	int head;               /* block the reader is in */
+	int tail;               /* next block the thread fills */
+	int count;              /* filled blocks */
+	int read_offset;        /* into the head block */
+	int64_t buffered;       /* bytes filled and not read yet */
+	int64_t pos;            /* read position */
+	int64_t read_bytes;     /* from the source, for the throughput */
+	int64_t read_time;
+
+	int eof;
+	int error;
+	int seek_req;
+	int64_t seek_pos;
+	int64_t seek_ret;
+	int quit;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+} ReadAhead;
+
+static void *prefetch(void *arg) {
+	ReadAhead *ra = arg;
+	ReadAheadBlock *block;
+	int64_t start;
+	int64_t ret;
+	int n;
+
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		while (!ra->quit && !ra->seek_req &&
+				(ra->count == ra->nb_blocks || ra->eof || ra->error)) {
+			pthread_cond_wait(&ra->cond, &ra->lock);
+		}
+
+		if (ra->quit) {
+			break;
+		}
+
+		if (ra->seek_req) {
+			pthread_mutex_unlock(&ra->lock);
+			ret = avio_seek(ra->source, ra->seek_pos, SEEK_SET);
+			pthread_mutex_lock(&ra->lock);
+
+			ra->head = ra->tail = ra->count = 0;
+			ra->read_offset = 0;
+			ra->buffered = 0;
+			ra->eof = ra->error = 0;
+			ra->seek_ret = ret;
+			ra->seek_req = 0;
+			pthread_cond_broadcast(&ra->cond);
+			continue;
+		}
+
+		block = &ra->blocks[ra->tail];
+		pthread_mutex_unlock(&ra->lock);
+		start = av_gettime_relative();
+		n = avio_read_partial(ra->source, block->data, READAHEAD_BLOCK_SIZE);
+		pthread_mutex_lock(&ra->lock);
+
+		if (n > 0) {
+			ra->read_bytes += n;
+			ra->read_time += av_gettime_relative() - start;
+		}
+
+		if (ra->seek_req) {
+			// read from where the reader no longer is
+			continue;
+		}
+
+		if (n > 0) {
+			block->size = n;
+			ra->tail = (ra->tail + 1) % ra->nb_blocks;
+			ra->count++;
+			ra->buffered += n;
+		} else if (n == 0 || n == AVERROR_EOF) {
+			ra->eof = 1;
+		} else {
+			ra->error = n;
+		}
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->lock);
+
+	return NULL;
+}
+
+/* Waits on the condition, returns non zero if the reader was interrupted */
+static int wait_interruptible(ReadAhead *ra) {
+	struct timespec deadline;
+
+	if (ra->int_cb.callback && ra->int_cb.callback(ra->int_cb.opaque)) {
+		return 1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += READAHEAD_POLL_NS;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait(&ra->cond, &ra->lock, &deadline);
+
+	return 0;
+}
+
+/* Drops n buffered bytes, n must not exceed what is buffered */
+static void skip_buffered(ReadAhead *ra, int64_t n) {
+	ReadAheadBlock *block;
+	int chunk;
+
+	while (n > 0) {
+		block = &ra->blocks[ra->head];
+		chunk = block->size - ra->read_offset;
+		if (chunk > n) {
+			chunk = n;
+		}
+
+		ra->read_offset += chunk;
+		ra->buffered -= chunk;
+		ra->pos += chunk;
+		n -= chunk;
+
+		if (ra->read_offset == block->size) {
+			ra->head = (ra->head + 1) % ra->nb_blocks;
+			ra->count--;
+			ra->read_offset = 0;
+			// room for the thread to fill
+			pthread_cond_broadcast(&ra->cond);
+		}
+	}
+}
+
+static int readahead_read(void *opaque, uint8_t *buf, int buf_size) {
+	ReadAhead *ra = opaque;
+	ReadAheadBlock *block;
+	int n;
+
+	pthread_mutex_lock(&ra->lock);
+	while (!ra->count && !ra->eof && !ra->error) {
+		if (wait_interruptible(ra)) {
+			pthread_mutex_unlock(&ra->lock);
+			return AVERROR_EXIT;
+		}
+	}
+
+	if (!ra->count) {
+		n = ra->error ? ra->error : AVERROR_EOF;
+		pthread_mutex_unlock(&ra->lock);
+		return n;
+	}
+
+	block = &ra->blocks[ra->head];
+	n = block->size - ra->read_offset;
+	if (n > buf_size) {
+		n = buf_size;
+	}
+	memcpy(buf, block->data + ra->read_offset, n);
+	skip_buffered(ra, n);
+	pthread_mutex_unlock(&ra->lock);
+
+	return n;
+}
+
+static int64_t readahead_seek(void *opaque, int64_t offset, int whence) {
+	ReadAhead *ra = opaque;
+	int64_t pos;
+	int64_t ret;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return ra->size >= 0 ? ra->size : AVERROR(ENOSYS);
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pthread_mutex_lock(&ra->lock);
+		pos = ra->pos + offset;
+		pthread_mutex_unlock(&ra->lock);
+		break;
+	case SEEK_END:
+		if (ra->size < 0) {
+			return AVERROR(ENOSYS);
+		}
+		pos = ra->size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (pos < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	pthread_mutex_lock(&ra->lock);
+
+	if (pos >= ra->pos && pos - ra->pos <= ra->buffered) {
+		// already read ahead
+		skip_buffered(ra, pos - ra->pos);
+		pthread_mutex_unlock(&ra->lock);
+		return pos;
+	}
+
+	ra->seek_pos = pos;
+	ra->seek_req = 1;
+	pthread_cond_broadcast(&ra->cond);
+	while (ra->seek_req) {
+		if (wait_interruptible(ra)) {
+			pthread_mutex_unlock(&ra->lock);
+			return AVERROR_EXIT;
+		}
+	}
+
+	ret = ra->seek_ret;
+	if (ret >= 0) {
+		ra->pos = pos;
+	} else {
+		// the thread dropped what it had, reread from the old position
+		ra->seek_pos = ra->pos;
+		ra->seek_req = 1;
+		pthread_cond_broadcast(&ra->cond);
+	}
+	pthread_mutex_unlock(&ra->lock);
+
+	return ret >= 0 ? pos : ret;
+}
+
+static void free_readahead(ReadAhead *ra) {
+	int i;
+
+	if (ra->blocks) {
+		for (i = 0; i < ra->nb_blocks; i++) {
+			free(ra->blocks[i].data);
+		}
+		av_free(ra->blocks);
+	}
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->lock);
+	av_free(ra);
+}
+
+AVIOContext *readahead_open(AVIOContext *source, int size, const AVIOInterruptCB *int_cb) {
+	AVIOContext *pb = NULL;
+	uint8_t *buffer;
+	ReadAhead *ra;
+	int i;
+
+	if (!source || size <= 0) {
+		return NULL;
+	}
+
+	ra = av_mallocz(sizeof(ReadAhead));
+	if (!ra) {
+		return NULL;
+	}
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+
+	ra->source = source;
+	if (int_cb) {
+		ra->int_cb = *int_cb;
+	}
+	ra->size = avio_size(source);
+	ra->pos = avio_tell(source);
+
+	ra->nb_blocks = (size + READAHEAD_BLOCK_SIZE - 1) / READAHEAD_BLOCK_SIZE;
+	if (ra->nb_blocks < 2) {
+		ra->nb_blocks = 2;
+	}
+	ra->blocks = av_mallocz_array(ra->nb_blocks, sizeof(ReadAheadBlock));
+	if (!ra->blocks) {
+		free_readahead(ra);
+		return NULL;
+	}
+	for (i = 0; i < ra->nb_blocks; i++) {
+		if (posix_memalign((void **) &ra->blocks[i].data, READAHEAD_ALIGNMENT, READAHEAD_BLOCK_SIZE) != 0) {
+			ra->blocks[i].data = NULL;
+			free_readahead(ra);
+			return NULL;
+		}
+	}
+
+	// the demuxer reads whole blocks anyway, keep its own buffer small
+	buffer = av_malloc(READAHEAD_ALIGNMENT);
+	if (buffer) {
+		pb = avio_alloc_context(buffer, READAHEAD_ALIGNMENT, 0, ra, readahead_read, NULL,
+				source->seekable ? readahead_seek : NULL);
+	}
+	if (!pb) {
+		av_free(buffer);
+		free_readahead(ra);
+		return NULL;
+	}
+	pb->seekable = source->seekable;
+
+	if (pthread_create(&ra->thread, NULL, prefetch, ra) != 0) {
+		av_freep(&pb->buffer);
+		avio_context_free(&pb);
+		free_readahead(ra);
+		return NULL;
+	}
+
+	return pb;
+}
+
+void readahead_close(AVIOContext **pb) {
+	ReadAhead *ra;
+
+	if (!pb || !*pb) {
+		return;
+	}
+
+	ra = (*pb)->opaque;
+
+	pthread_mutex_lock(&ra->lock);
+	ra->quit = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+	pthread_join(ra->thread, NULL);
+
+	free_readahead(ra);
+
+	av_freep(&(*pb)->buffer);
+	avio_context_free(pb);
+}
+
+int64_t readahead_buffered(AVIOContext *pb) {
+	ReadAhead *ra;
+	int64_t buffered;
+
+	if (!pb) {
+		return -1;
+	}
+
+	ra = pb->opaque;
+	pthread_mutex_lock(&ra->lock);
+	buffered = ra->buffered;
+	pthread_mutex_unlock(&ra->lock);
+
+	return buffered;
+}
+
+void readahead_stats(AVIOContext *pb, int64_t *bytes, int64_t *time_us) {
+	ReadAhead *ra;
+
+	*bytes = 0;
+	*time_us = 0;
+
+	if (!pb) {
+		return;
+	}
+
+	ra = pb->opaque;
+	pthread_mutex_lock(&ra->lock);
+	*bytes = ra->read_bytes;
+	*time_us = ra->read_time;
+	pthread_mutex_unlock(&ra->lock);
+}
@@ -0,0 +1,50 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef READAHEAD_H_
+#define READAHEAD_H_
+
+#include <stdint.h>
+#include <libavformat/avio.h>
+
+#define READAHEAD_BLOCK_SIZE (256 * 1024)
+#define READAHEAD_ALIGNMENT 4096
+#define DEFAULT_READAHEAD_SIZE (2 * 1024 * 1024)
+#define MAX_READAHEAD_SIZE (64 * 1024 * 1024)
+
+/*
+ * Prefetching AVIOContext. A thread keeps up to size bytes of the source
+ * read ahead of the demuxer, in a ring of large aligned blocks, so the
+ * demuxer reads from memory and rides out stalls of the source. Seeks
+ * into the buffered data are served without touching the source.
+ *
+ * The source stays owned by the caller and must outlive the context.
+ */
+AVIOContext *readahead_open(AVIOContext *source, int size, const AVIOInterruptCB *int_cb);
+void readahead_close(AVIOContext **pb);
+
+/* Bytes buffered ahead of the read position, -1 if pb is NULL */
+int64_t readahead_buffered(AVIOContext *pb);
+
+/*
+ * Totals of the bytes read from the source and the microseconds spent
+ * waiting for them, the ratio is the throughput of the source.
+ */
+void readahead_stats(AVIOContext *pb, int64_t *bytes, int64_t *time_us);
+
+#endif /*READAHEAD_H_*/
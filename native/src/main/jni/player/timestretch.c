@@ -0,0 +1,329 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <timestretch.h>
+
+#define SEQUENCE_MS 40
+#define SEEK_WINDOW_MS 15
+#define OVERLAP_MS 8
+#define MAX_OVERLAP_FRAMES 1024
+#define COARSE_SEEK_STEP 4
+
+/*
+ * Cross-correlation of two S16 buffers plus the energy of the second one.
+ * The products are summed in 64 bit lanes, so nothing overflows whatever
+ * the overlap length and channel count. SSE2 has no widening 32 bit
+ * multiply, and _mm_madd_epi16 overflows on two pairs of -32768, so the
+ * inputs are halved for it and the sums scaled back up, dropping only
+ * their lowest bits.
+ */
+static int64_t correlate_s16(const int16_t *a, const int16_t *b, int n, int64_t *norm) {
+	int64_t corr = 0;
+	int64_t energy = 0;
+	int i = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+	int64x2_t acc_corr = vdupq_n_s64(0);
+	int64x2_t acc_norm = vdupq_n_s64(0);
+
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t va = vld1q_s16(a + i);
+		int16x8_t vb = vld1q_s16(b + i);
+
+		acc_corr = vpadalq_s32(acc_corr, vmull_s16(vget_low_s16(va), vget_low_s16(vb)));
+		acc_corr = vpadalq_s32(acc_corr, vmull_s16(vget_high_s16(va), vget_high_s16(vb)));
+		acc_norm = vpadalq_s32(acc_norm, vmull_s16(vget_low_s16(vb), vget_low_s16(vb)));
+		acc_norm = vpadalq_s32(acc_norm, vmull_s16(vget_high_s16(vb), vget_high_s16(vb)));
+	}
+
+	corr = vgetq_lane_s64(acc_corr, 0) + vgetq_lane_s64(acc_corr, 1);
+	energy = vgetq_lane_s64(acc_norm, 0) + vgetq_lane_s64(acc_norm, 1);
+#elif defined(__SSE2__)
+	__m128i acc_corr = _mm_setzero_si128();
+	__m128i acc_norm = _mm_setzero_si128();
+	int64_t lanes[2];
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i va = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (a + i)), 1);
+		__m128i vb = _mm_srai_epi16(_mm_loadu_si128((const __m128i *) (b + i)), 1);
+		__m128i vc = _mm_madd_epi16(va, vb);
+		__m128i vn = _mm_madd_epi16(vb, vb);
+
+		/* sign extend the 32 bit pair sums into the 64 bit lanes */
+		acc_corr = _mm_add_epi64(acc_corr, _mm_unpacklo_epi32(vc, _mm_srai_epi32(vc, 31)));
+		acc_corr = _mm_add_epi64(acc_corr, _mm_unpackhi_epi32(vc, _mm_srai_epi32(vc, 31)));
+		acc_norm = _mm_add_epi64(acc_norm, _mm_unpacklo_epi32(vn, _mm_srai_epi32(vn, 31)));
+		acc_norm = _mm_add_epi64(acc_norm, _mm_unpackhi_epi32(vn, _mm_srai_epi32(vn, 31)));
+	}
+
+	_mm_storeu_si128((__m128i *) lanes, acc_corr);
+	corr = (lanes[0] + lanes[1]) * 4;
+	_mm_storeu_si128((__m128i *) lanes, acc_norm);
+	energy = (lanes[0] + lanes[1]) * 4;
+#endif
+
+	for (; i < n; i++) {
+		corr += (int32_t) a[i] * b[i];
+		energy += (int32_t) b[i] * b[i];
+	}
+
+	*norm = energy;
+	return corr;
+}
+
+static double overlap_score(TimeStretch *ts, const int16_t *src, int offset) {
+	int64_t norm = 0;
+	int64_t corr = correlate_s16(ts->mid_buffer, src + offset * ts->channels,
+			ts->overlap_frames * ts->channels, &norm);
+
+	return (double) corr / sqrt((double) norm + 1.0);
+}
+
+/* Finds the offset in [0, seek_frames) where src best continues mid_buffer. */
+static int seek_best_overlap(TimeStretch *ts, const int16_t *src) {
+	int best_offset = 0;
+	double best_score = -INFINITY;
+	int offset, start, end;
+
+	/* coarse pass over the whole window */
+	for (offset = 0; offset < ts->seek_frames; offset += COARSE_SEEK_STEP) {
+		double score = overlap_score(ts, src, offset);
+		if (score > best_score) {
+			best_score = score;
+			best_offset = offset;
+		}
+	}
+
+	/* refine around the coarse winner */
+	start = best_offset - COARSE_SEEK_STEP + 1;
+	end = best_offset + COARSE_SEEK_STEP - 1;
+	if (start < 0) {
+		start = 0;
+	}
+	if (end >= ts->seek_frames) {
+		end = ts->seek_frames - 1;
+	}
+
+	for (offset = start; offset <= end; offset++) {
+		double score;
+
+		if (offset == best_offset) {
+			continue;
+		}
+
+		score = overlap_score(ts, src, offset);
+		if (score > best_score) {
+			best_score = score;
+			best_offset = offset;
+		}
+	}
+
+	return best_offset;
+}
+
+/* Linear crossfade from mid_buffer into src. */
+static void overlap_add(TimeStretch *ts, int16_t *out, const int16_t *src) {
+	int length = ts->overlap_frames;
+	int i, c;
+
+	for (i = 0; i < length; i++) {
+		for (c = 0; c < ts->channels; c++) {
+			int index = i * ts->channels + c;
+			out[index] = (int16_t) (((int32_t) ts->mid_buffer[index] * (length - i) +
+					(int32_t) src[index] * i) / length);
+		}
+	}
+}
+
+static int ensure_input_capacity(TimeStretch *ts, int frames) {
+	int16_t *input;
+
+	if (frames <= ts->input_capacity) {
+		return 0;
+	}
+
+	input = realloc(ts->input, frames * ts->channels * sizeof(int16_t));
+	if (!input) {
+		return -1;
+	}
+
+	ts->input = input;
+	ts->input_capacity = frames;
+	return 0;
+}
+
+TimeStretch *timestretch_create(int channels, int sample_rate) {
+	TimeStretch *ts;
+
+	if (channels <= 0 || sample_rate <= 0) {
+		return NULL;
+	}
+
+	ts = calloc(1, sizeof(TimeStretch));
+	if (!ts) {
+		return NULL;
+	}
+
+	ts->channels = channels;
+	ts->sample_rate = sample_rate;
+	ts->tempo = 1.0f;
+
+	ts->overlap_frames = (sample_rate * OVERLAP_MS / 1000) & ~7;
+	if (ts->overlap_frames < 16) {
+		ts->overlap_frames = 16;
+	} else if (ts->overlap_frames > MAX_OVERLAP_FRAMES) {
+		ts->overlap_frames = MAX_OVERLAP_FRAMES;
+	}
+	ts->sequence_frames = sample_rate * SEQUENCE_MS / 1000;
+	if (ts->sequence_frames < 2 * ts->overlap_frames) {
+		ts->sequence_frames = 2 * ts->overlap_frames;
+	}
+	ts->seek_frames = sample_rate * SEEK_WINDOW_MS / 1000;
+	if (ts->seek_frames < COARSE_SEEK_STEP) {
+		ts->seek_frames = COARSE_SEEK_STEP;
+	}
+
+	ts->mid_buffer = calloc(ts->overlap_frames * channels, sizeof(int16_t));
+	if (!ts->mid_buffer || ensure_input_capacity(ts, ts->sequence_frames * 4) < 0) {
+		timestretch_free(&ts);
+		return NULL;
+	}
+
+	return ts;
+}
+
+void timestretch_set_tempo(TimeStretch *ts, float tempo) {
+	if (tempo < MIN_PLAYBACK_SPEED) {
+		tempo = MIN_PLAYBACK_SPEED;
+	} else if (tempo > MAX_PLAYBACK_SPEED) {
+		tempo = MAX_PLAYBACK_SPEED;
+	}
+
+	ts->tempo = tempo;
+}
+
+/*
+ * Appends in_frames of input and writes up to max_out_frames of stretched
+ * output. The input is copied before any output is written, so in and out
+ * may point to the same buffer. Returns the number of frames written.
+ */
+int timestretch_process(TimeStretch *ts, const int16_t *in, int in_frames, int16_t *out, int max_out_frames) {
+	int channels = ts->channels;
+	int out_frames = 0;
+	int consumed = 0;
+	int step, temp, int_skip, sample_req;
+	double nominal_skip;
+
+	if (in_frames > 0) {
+		if (ensure_input_capacity(ts, ts->input_frames + in_frames) < 0) {
+			return -1;
+		}
+		memcpy(ts->input + ts->input_frames * channels, in, in_frames * channels * sizeof(int16_t));
+		ts->input_frames += in_frames;
+	}
+
+	if (ts->tempo == 1.0f) {
+		/* pass through, draining whatever is left from a previous tempo */
+		if (ts->primed && max_out_frames >= ts->overlap_frames) {
+			memcpy(out, ts->mid_buffer, ts->overlap_frames * channels * sizeof(int16_t));
+			out_frames = ts->overlap_frames;
+			ts->primed = 0;
+		}
+
+		consumed = ts->input_frames;
+		if (consumed > max_out_frames - out_frames) {
+			consumed = max_out_frames - out_frames;
+		}
+		memcpy(out + out_frames * channels, ts->input, consumed * channels * sizeof(int16_t));
+		out_frames += consumed;
+	} else {
+		step = ts->sequence_frames - ts->overlap_frames;
+		temp = ts->sequence_frames - 2 * ts->overlap_frames;
+		nominal_skip = ts->tempo * step;
+		int_skip = (int) (nominal_skip + 0.5);
+		sample_req = (int_skip + ts->overlap_frames > ts->sequence_frames ?
+				int_skip + ts->overlap_frames : ts->sequence_frames) + ts->seek_frames;
+
+		while (ts->input_frames - consumed >= sample_req && out_frames + step <= max_out_frames) {
+			const int16_t *src = ts->input + consumed * channels;
+			int16_t *dst = out + out_frames * channels;
+			int skip;
+
+			if (!ts->primed) {
+				memcpy(dst, src, step * channels * sizeof(int16_t));
+				memcpy(ts->mid_buffer, src + step * channels,
+						ts->overlap_frames * channels * sizeof(int16_t));
+				ts->primed = 1;
+			} else {
+				int offset = seek_best_overlap(ts, src);
+
+				overlap_add(ts, dst, src + offset * channels);
+				memcpy(dst + ts->overlap_frames * channels,
+						src + (offset + ts->overlap_frames) * channels,
+						temp * channels * sizeof(int16_t));
+				memcpy(ts->mid_buffer, src + (offset + temp + ts->overlap_frames) * channels,
+						ts->overlap_frames * channels * sizeof(int16_t));
+			}
+			out_frames += step;
+
+			ts->skip_fract += nominal_skip;
+			skip = (int) ts->skip_fract;
+			ts->skip_fract -= skip;
+			consumed += skip;
+		}
+	}
+
+	if (consumed > 0) {
+		ts->input_frames -= consumed;
+		memmove(ts->input, ts->input + consumed * channels, ts->input_frames * channels * sizeof(int16_t));
+	}
+
+	return out_frames;
+}
+
+/* Number of input frames accepted but not yet reflected in the output. */
+int timestretch_latency(TimeStretch *ts) {
+	return ts->input_frames;
+}
+
+void timestretch_reset(TimeStretch *ts) {
+	ts->input_frames = 0;
+	ts->skip_fract = 0;
+	ts->primed = 0;
+}
+
+void timestretch_free(TimeStretch **ps) {
+	TimeStretch *ts = *ps;
+
+	if (ts) {
+		free(ts->input);
+		free(ts->mid_buffer);
+		free(ts);
+		*ps = NULL;
+	}
+}
@@ -0,0 +1,55 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIMESTRETCH_H_
+#define TIMESTRETCH_H_
+
+#include <stdint.h>
+
+#define MIN_PLAYBACK_SPEED 0.5f
+#define MAX_PLAYBACK_SPEED 3.0f
+
+/*
+ * WSOLA (waveform similarity overlap-add) time stretcher for interleaved
+ * S16 PCM. Changes the tempo of the audio without changing its pitch.
+ */
+typedef struct TimeStretch {
+	int channels;
+	int sample_rate;
+	float tempo;
+
+	int sequence_frames;  /* length of one processing sequence */
+	int seek_frames;      /* window searched for the best overlap position */
+	int overlap_frames;   /* length of the crossfade between sequences */
+	double skip_fract;
+	int primed;
+
+	int16_t *input;       /* pending input, interleaved */
+	int input_frames;
+	int input_capacity;
+	int16_t *mid_buffer;  /* tail of the previous sequence, overlap_frames long */
+} TimeStretch;
+
+TimeStretch *timestretch_create(int channels, int sample_rate);
+void timestretch_set_tempo(TimeStretch *ts, float tempo);
+int timestretch_process(TimeStretch *ts, const int16_t *in, int in_frames, int16_t *out, int max_out_frames);
+int timestretch_latency(TimeStretch *ts);
+void timestretch_reset(TimeStretch *ts);
+void timestretch_free(TimeStretch **ts);
+
+#endif /*TIMESTRETCH_H_*/
@@ -52,6 +52,21 @@ struct SwsContext *createScaler(VideoPlayer **ps, AVCodecContext *codec) {
 	return sws_ctx;
 }
 
+/* Returns sws_ctx, or a new scaler if the decoded size or format changed */
+struct SwsContext *updateScaler(VideoPlayer **ps, struct SwsContext *sws_ctx, AVCodecContext *codec) {
+	return sws_getCachedContext(sws_ctx,
+			codec->width,
+			codec->height,
+			codec->pix_fmt,
+			codec->width,
+			codec->height,
+			AV_PIX_FMT_RGBA,
+			SWS_BILINEAR,
+			NULL,
+			NULL,
+			NULL);
+}
+
 void *createBmp(VideoPlayer **ps, int width, int height) {
 	VideoPlayer *is = *ps;
 
@@ -37,6 +37,7 @@ void createVideoEngine(VideoPlayer **ps);
 void createScreen(VideoPlayer **ps, void *surface, int width, int height);
 void setSurface(VideoPlayer **ps, void *surface);
 struct SwsContext *createScaler(VideoPlayer **ps, AVCodecContext *codec);
+struct SwsContext *updateScaler(VideoPlayer **ps, struct SwsContext *sws_ctx, AVCodecContext *codec);
 void *createBmp(VideoPlayer **ps, int width, int height);
 void destroyBmp(VideoPlayer **ps, void *bmp);
 void updateBmp(VideoPlayer **ps, struct SwsContext *sws_ctx, AVCodecContext *pCodecCtx, void *bmp, AVFrame *pFrame, int width, int height);
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 #include "jni.h"
 #include "Errors.h"  // for int
 
@@ -46,6 +47,7 @@ struct fields_t {
     jfieldID    surface_texture;
     
     jmethodID   post_event;
+    jclass      string_class;   // global ref, for the metadata key value arrays
 };
 static fields_t fields;
 
@@ -59,7 +61,7 @@ class JNIMediaPlayerListener: public MediaPlayerListener
 public:
     JNIMediaPlayerListener(JNIEnv* env, jobject thiz, jobject weak_thiz);
     ~JNIMediaPlayerListener();
-    virtual void notify(int msg, int ext1, int ext2, int from_thread);
+    virtual void notify(int msg, int ext1, int ext2, int from_thread, const AVDictionary *obj = NULL);
     //virtual void notify(int msg, int ext1, int ext2, const Parcel *obj = NULL);
 private:
     JNIMediaPlayerListener();
@@ -74,6 +76,64 @@ void jniThrowException(JNIEnv* env, const char* className,
     env->ThrowNew(exception, msg);
 }
 
+// Flattens a native dictionary into a String[] of alternating keys and
+// values. Java builds the map from it, instead of a JNI call per entry.
+static jobjectArray createKeyValueArray(JNIEnv *env, const AVDictionary *dict)
+{
+    int count = dict ? dict->count : 0;
+    jobjectArray array = env->NewObjectArray(count * 2, fields.string_class, NULL);
+    if (array == NULL) {
+        return NULL;
+    }
+    
+    int i = 0;
+    
+    for (i = 0; i < count; i++) {
+        jstring jKey = env->NewStringUTF(dict->elems[i].key);
+        jstring jValue = env->NewStringUTF(dict->elems[i].value);
+        env->SetObjectArrayElement(array, i * 2, jKey);
+        env->SetObjectArrayElement(array, i * 2 + 1, jValue);
+        env->DeleteLocalRef(jKey);
+        env->DeleteLocalRef(jValue);
+    }
+    
+    return array;
+}
+
+static pthread_key_t sAttachedKey;
+static pthread_once_t sAttachedKeyOnce = PTHREAD_ONCE_INIT;
+
+static void detachThread(void *env)
+{
+    m_vm->DetachCurrentThread();
+}
+
+static void createAttachedKey()
+{
+    pthread_key_create(&sAttachedKey, detachThread);
+}
+
+// Events from native threads all arrive on the event dispatcher thread, which
+// is attached on its first event and stays attached until it exits.
+static JNIEnv *getJNIEnv()
+{
+    JNIEnv *env = 0;
+
+    if (m_vm->GetEnv((void**)&env, JNI_VERSION_1_6) == JNI_OK) {
+        return env;
+    }
+
+    if (m_vm->AttachCurrentThread(&env, NULL) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "failed to attach current thread");
+        return 0;
+    }
+
+    pthread_once(&sAttachedKeyOnce, createAttachedKey);
+    pthread_setspecific(sAttachedKey, env);
+
+    return env;
+}
+
 JNIMediaPlayerListener::JNIMediaPlayerListener(JNIEnv* env, jobject thiz, jobject weak_thiz)
 {
     
@@ -104,26 +164,15 @@ JNIMediaPlayerListener::~JNIMediaPlayerListener()
     env->DeleteGlobalRef(mThiz);
 }
 
-void JNIMediaPlayerListener::notify(int msg, int ext1, int ext2, int fromThread)
+void JNIMediaPlayerListener::notify(int msg, int ext1, int ext2, int fromThread, const AVDictionary *obj)
 //void JNIMediaPlayerListener::notify(int msg, int ext1, int ext2)
 //void JNIMediaPlayerListener::notify(int msg, int ext1, int ext2, const Parcel *obj)
 {
     __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "notify: %d", msg);
-    JNIEnv *env = 0;
-    int isAttached = 0;
-    
-    int status  = m_vm->GetEnv((void**)&env, JNI_VERSION_1_6);
-    
-    if (fromThread) {
-        jclass *interface_class;
-        
-        isAttached = 0;
-        
-        if (m_vm->AttachCurrentThread(&env, NULL) < 0) {
-            __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "failed to attach current thread");
-        }
-        
-        isAttached = 1;
+    JNIEnv *env = getJNIEnv();
+
+    if (!env) {
+        return;
     }
     
     //JNIEnv *env = AndroidRuntime::getJNIEnv();
@@ -137,8 +186,16 @@ void JNIMediaPlayerListener::notify(int msg, int ext1, int ext2, int fromThread)
      env->DeleteLocalRef(jParcel);
      }
      } else {*/
-    env->CallStaticVoidMethod(mClass, fields.post_event, mObject,
-                              msg, ext1, ext2, NULL);
+    if (obj) {
+        // the keys that changed with a MEDIA_INFO_METADATA_UPDATE
+        jobjectArray keyValues = createKeyValueArray(env, obj);
+        env->CallStaticVoidMethod(mClass, fields.post_event, mObject,
+                                  msg, ext1, ext2, keyValues);
+        env->DeleteLocalRef(keyValues);
+    } else {
+        env->CallStaticVoidMethod(mClass, fields.post_event, mObject,
+                                  msg, ext1, ext2, NULL);
+    }
     //}
     
     if (env->ExceptionCheck()) {
@@ -146,10 +203,6 @@ void JNIMediaPlayerListener::notify(int msg, int ext1, int ext2, int fromThread)
         //LOGW_EX(env);
         env->ExceptionClear();
     }
-    
-    if (fromThread && isAttached) {
-    	m_vm->DetachCurrentThread();
-    }
 }
 
 // ----------------------------------------------------------------------------
@@ -401,6 +454,20 @@ wseemann_media_FFmpegMediaPlayer_prepare(JNIEnv *env, jobject thiz)
     process_media_player_call( env, thiz, mp->prepare(), "java/io/IOException", "Prepare failed." );
 }
 
+static void
+wseemann_media_FFmpegMediaPlayer_prepareWithTimeout(JNIEnv *env, jobject thiz, jint timeoutMs)
+{
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    
+    status_t opStatus = mp->prepare(timeoutMs);
+    process_media_player_call( env, thiz, opStatus, "java/io/IOException",
+                               opStatus == TIMED_OUT ? "Prepare timed out." : "Prepare failed." );
+}
+
 static void
 wseemann_media_FFmpegMediaPlayer_prepareAsync(JNIEnv *env, jobject thiz)
 {
@@ -603,6 +670,161 @@ wseemann_media_FFmpegMediaPlayer_setVolume(JNIEnv *env, jobject thiz, float left
     process_media_player_call( env, thiz, mp->setVolume(leftVolume, rightVolume), NULL, NULL );
 }
 
+static void
+wseemann_media_FFmpegMediaPlayer_setPlaybackSpeed(JNIEnv *env, jobject thiz, float speed)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setPlaybackSpeed: %f", speed);
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    process_media_player_call( env, thiz, mp->setPlaybackSpeed(speed), "java/lang/IllegalArgumentException", "Playback speed out of range" );
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setLoudnessNormalization(JNIEnv *env, jobject thiz, jint mode)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setLoudnessNormalization: %d", mode);
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    process_media_player_call( env, thiz, mp->setLoudnessNormalization(mode), "java/lang/IllegalArgumentException", "Unknown loudness normalization mode" );
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setCrossfadeDuration(JNIEnv *env, jobject thiz, jint msec)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setCrossfadeDuration: %d", msec);
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    process_media_player_call( env, thiz, mp->setCrossfadeDuration(msec), "java/lang/IllegalArgumentException", "Crossfade duration out of range" );
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setPreroll(JNIEnv *env, jobject thiz, jint msec)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setPreroll: %d", msec);
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    process_media_player_call( env, thiz, mp->setPreroll(msec), "java/lang/IllegalArgumentException", "Preroll out of range" );
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setLiveLatency(JNIEnv *env, jobject thiz, jint msec)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setLiveLatency: %d", msec);
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    process_media_player_call( env, thiz, mp->setLiveLatency(msec), "java/lang/IllegalArgumentException", "Live latency out of range" );
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setReadAheadSize(JNIEnv *env, jobject thiz, jint bytes)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setReadAheadSize: %d", bytes);
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    process_media_player_call( env, thiz, mp->setReadAheadSize(bytes), "java/lang/IllegalArgumentException", "Read-ahead size out of range" );
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setHttpCacheDirectory(JNIEnv *env, jclass clazz, jstring path, jlong maxBytes)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setHttpCacheDirectory");
+    const char *tmp = NULL;
+
+    if (path != NULL) {
+        tmp = env->GetStringUTFChars(path, NULL);
+        if (tmp == NULL) {  // Out of memory
+            return;
+        }
+    }
+
+    if (::setHttpCacheDirectory(tmp, maxBytes) != NO_ERROR) {
+        jniThrowException(env, "java/lang/IllegalArgumentException", "Unusable http cache directory or size");
+    }
+
+    if (tmp != NULL) {
+        env->ReleaseStringUTFChars(path, tmp);
+    }
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setOption(JNIEnv *env, jobject thiz, jstring key, jstring value)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setOption");
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+
+    if (key == NULL) {
+        jniThrowException(env, "java/lang/IllegalArgumentException", NULL);
+        return;
+    }
+
+    const char *keyStr = env->GetStringUTFChars(key, NULL);
+    if (keyStr == NULL) {  // Out of memory
+        return;
+    }
+
+    const char *valueStr = NULL;
+    if (value != NULL) {
+        valueStr = env->GetStringUTFChars(value, NULL);
+        if (valueStr == NULL) {  // Out of memory
+            env->ReleaseStringUTFChars(key, keyStr);
+            return;
+        }
+    }
+
+    status_t opStatus = mp->setOption(keyStr, valueStr);
+
+    env->ReleaseStringUTFChars(key, keyStr);
+    if (valueStr != NULL) {
+        env->ReleaseStringUTFChars(value, valueStr);
+    }
+
+    process_media_player_call( env, thiz, opStatus, "java/lang/IllegalArgumentException", "Invalid option" );
+}
+
+static void
+wseemann_media_FFmpegMediaPlayer_setProbeCacheDirectory(JNIEnv *env, jclass clazz, jstring path)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setProbeCacheDirectory");
+    const char *tmp = NULL;
+
+    if (path != NULL) {
+        tmp = env->GetStringUTFChars(path, NULL);
+        if (tmp == NULL) {  // Out of memory
+            return;
+        }
+    }
+
+    if (::setProbeCacheDirectory(tmp) != NO_ERROR) {
+        jniThrowException(env, "java/lang/IllegalArgumentException", "Unusable probe cache directory");
+    }
+
+    if (tmp != NULL) {
+        env->ReleaseStringUTFChars(path, tmp);
+    }
+}
+
 // Sends the new filter to the client.
 static jint
 wseemann_media_FFmpegMediaPlayer_setMetadataFilter(JNIEnv *env, jobject thiz, jobjectArray allow, jobjectArray block)
@@ -637,14 +859,14 @@ wseemann_media_FFmpegMediaPlayer_setMetadataFilter(JNIEnv *env, jobject thiz, jo
     return 0;
 }
 
-static jobject
+static jobjectArray
 wseemann_media_FFmpegMediaPlayer_getMetadata(JNIEnv *env, jobject thiz, jboolean update_only,
-                                             jboolean apply_filter, jobject reply)
+                                             jboolean apply_filter)
 {
     MediaPlayer* media_player = getMediaPlayer(env, thiz);
     if (media_player == NULL ) {
         jniThrowException(env, "java/lang/IllegalStateException", NULL);
-        return JNI_FALSE;
+        return NULL;
     }
     
     // On return metadata is positioned at the beginning of the
@@ -654,30 +876,43 @@ wseemann_media_FFmpegMediaPlayer_getMetadata(JNIEnv *env, jobject thiz, jboolean
     AVDictionary *metadata = NULL;
     
     if (media_player->getMetadata(update_only, apply_filter, &metadata) == 0) {
-        jclass hashMap_Clazz = env->FindClass("java/util/HashMap");
-        jmethodID gHashMap_initMethodID = env->GetMethodID(hashMap_Clazz, "<init>", "()V");
-        jobject map = env->NewObject(hashMap_Clazz, gHashMap_initMethodID);
-        jmethodID gHashMap_putMethodID = env->GetMethodID(hashMap_Clazz, "put", "(Ljava/lang/Object;Ljava/lang/Object;)Ljava/lang/Object;");
-        
-        int i = 0;
-        
-        for (i = 0; i < metadata->count; i++) {
-            jstring jKey = env->NewStringUTF(metadata->elems[i].key);
-            jstring jValue = env->NewStringUTF(metadata->elems[i].value);
-            (jobject) env->CallObjectMethod(map, gHashMap_putMethodID, jKey, jValue);
-            env->DeleteLocalRef(jKey);
-            env->DeleteLocalRef(jValue);
-        }
+        jobjectArray keyValues = createKeyValueArray(env, metadata);
         
         if (metadata) {
             av_dict_free(&metadata);
             
         }
         
-        return map;
+        return keyValues;
     } else {
-        return reply;
+        return NULL;
+    }
+}
+
+static jobjectArray
+wseemann_media_FFmpegMediaPlayer_probeMetadata(JNIEnv *env, jclass clazz, jstring path)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "probeMetadata");
+    if (path == NULL) {
+        jniThrowException(env, "java/lang/IllegalArgumentException", NULL);
+        return NULL;
+    }
+
+    const char *tmp = env->GetStringUTFChars(path, NULL);
+    if (tmp == NULL) {  // Out of memory
+        return NULL;
     }
+
+    AVDictionary *metadata = NULL;
+    jobjectArray keyValues = NULL;
+
+    if (::probeMetadata(tmp, &metadata) == 0) {
+        keyValues = createKeyValueArray(env, metadata);
+    }
+    av_dict_free(&metadata);
+
+    env->ReleaseStringUTFChars(path, tmp);
+    return keyValues;
 }
 
 // This function gets some field IDs, which in turn causes class initialization.
@@ -710,6 +945,13 @@ wseemann_media_FFmpegMediaPlayer_native_init(JNIEnv *env)
         return;
     }
     
+    clazz = env->FindClass("java/lang/String");
+    if (clazz == NULL) {
+        return;
+    }
+    fields.string_class = (jclass) env->NewGlobalRef(clazz);
+    env->DeleteLocalRef(clazz);
+    
     // Initialize libavformat and register all the muxers, demuxers and protocols.
     av_register_all();
     avformat_network_init();
@@ -808,7 +1050,7 @@ static void wseemann_media_FFmpegMediaPlayer_attachAuxEffect(JNIEnv *env,  jobje
 static void
 wseemann_media_FFmpegMediaPlayer_setNextMediaPlayer(JNIEnv *env, jobject thiz, jobject java_player)
 {
-    /*__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "setNextMediaPlayer");
+    __android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "setNextMediaPlayer");
     MediaPlayer* thisplayer = getMediaPlayer(env, thiz);
     if (thisplayer == NULL) {
         jniThrowException(env, "java/lang/IllegalStateException", "This player not initialized");
@@ -829,7 +1071,6 @@ wseemann_media_FFmpegMediaPlayer_setNextMediaPlayer(JNIEnv *env, jobject thiz, j
                               env, thiz, thisplayer->setNextMediaPlayer(nextplayer),
                               "java/lang/IllegalArgumentException",
                               "setNextMediaPlayer failed." );
-    ;*/
 }
 
 // ----------------------------------------------------------------------------
@@ -844,6 +1085,7 @@ static JNINativeMethod gMethods[] = {
     {"_setDataSource",       "(Ljava/io/FileDescriptor;JJ)V",    (void *)wseemann_media_FFmpegMediaPlayer_setDataSourceFD},
     {"_setVideoSurface",    "(Landroid/view/Surface;)V",        (void *)wseemann_media_FFmpegMediaPlayer_setVideoSurface},
     {"prepare",             "()V",                              (void *)wseemann_media_FFmpegMediaPlayer_prepare},
+    {"prepare",             "(I)V",                             (void *)wseemann_media_FFmpegMediaPlayer_prepareWithTimeout},
     {"prepareAsync",        "()V",                              (void *)wseemann_media_FFmpegMediaPlayer_prepareAsync},
     {"_start",              "()V",                              (void *)wseemann_media_FFmpegMediaPlayer_start},
     {"_stop",               "()V",                              (void *)wseemann_media_FFmpegMediaPlayer_stop},
@@ -860,8 +1102,18 @@ static JNINativeMethod gMethods[] = {
     {"setLooping",          "(Z)V",                             (void *)wseemann_media_FFmpegMediaPlayer_setLooping},
     {"isLooping",           "()Z",                              (void *)wseemann_media_FFmpegMediaPlayer_isLooping},
     {"setVolume",           "(FF)V",                            (void *)wseemann_media_FFmpegMediaPlayer_setVolume},
+    {"setPlaybackSpeed",    "(F)V",                             (void *)wseemann_media_FFmpegMediaPlayer_setPlaybackSpeed},
+    {"setLoudnessNormalization", "(I)V",                        (void *)wseemann_media_FFmpegMediaPlayer_setLoudnessNormalization},
+    {"setCrossfadeDuration", "(I)V",                            (void *)wseemann_media_FFmpegMediaPlayer_setCrossfadeDuration},
+    {"setPreroll",          "(I)V",                             (void *)wseemann_media_FFmpegMediaPlayer_setPreroll},
+    {"setLiveLatency",      "(I)V",                             (void *)wseemann_media_FFmpegMediaPlayer_setLiveLatency},
+    {"setProbeCacheDirectory", "(Ljava/lang/String;)V",         (void *)wseemann_media_FFmpegMediaPlayer_setProbeCacheDirectory},
+    {"setReadAheadSize",    "(I)V",                             (void *)wseemann_media_FFmpegMediaPlayer_setReadAheadSize},
+    {"setHttpCacheDirectory", "(Ljava/lang/String;J)V",         (void *)wseemann_media_FFmpegMediaPlayer_setHttpCacheDirectory},
+    {"setOption",           "(Ljava/lang/String;Ljava/lang/String;)V", (void *)wseemann_media_FFmpegMediaPlayer_setOption},
     {"native_setMetadataFilter", "([Ljava/lang/String;[Ljava/lang/String;)I", (void *)wseemann_media_FFmpegMediaPlayer_setMetadataFilter},
-    {"native_getMetadata", "(ZZLjava/util/HashMap;)Ljava/util/HashMap;", (void *)wseemann_media_FFmpegMediaPlayer_getMetadata},
+    {"native_probeMetadata", "(Ljava/lang/String;)[Ljava/lang/String;", (void *)wseemann_media_FFmpegMediaPlayer_probeMetadata},
+    {"native_getMetadata", "(ZZ)[Ljava/lang/String;", (void *)wseemann_media_FFmpegMediaPlayer_getMetadata},
     {"native_init",         "()V",                              (void *)wseemann_media_FFmpegMediaPlayer_native_init},
     {"native_setup",        "(Ljava/lang/Object;)V",          (void *)wseemann_media_FFmpegMediaPlayer_native_setup},
     {"native_finalize",     "()V",                              (void *)wseemann_media_FFmpegMediaPlayer_native_finalize},